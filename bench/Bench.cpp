@@ -0,0 +1,397 @@
+// Microbenchmarks for the hot paths of clid. Run with `make bench`, results are written as JSON
+// (default build/bench.json) so runs of different builds can be diffed.
+
+#include "Color.h"
+#include "Contrast.h"
+#include "Render.h"
+#include "Cache.h"
+#include "Convert.h"
+#include "Extract.h"
+#include "Gradient.h"
+#include "Stats.h"
+#include "Template.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// -------------------------------------------------------------
+// HARNESS
+// -------------------------------------------------------------
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    constexpr auto MinDuration = std::chrono::milliseconds(200);
+    const size_t Sizes[] = {25, 50, 100, 200};
+
+    struct Result {
+        std::string name;
+        size_t size;
+        double nsPerOp;
+        double bytesPerOp;
+        double allocsPerOp;
+    };
+
+    std::vector<Result> results;
+
+    /** Keep the compiler from optimizing a value away. */
+    template <typename T>
+    void Keep(const T& value) {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    /** Run body until MinDuration has passed. body returns the bytes it produced (0 if that does not apply). */
+    template <typename Body>
+    void Run(const std::string& name, size_t size, Body&& body) {
+        body(); // Warm up caches and lazily allocated buffers
+
+        size_t iterations = 0, bytes = 0;
+        size_t allocsBefore = Stats::Allocations();
+        auto start = Clock::now();
+        auto elapsed = Clock::duration::zero();
+        while (elapsed < MinDuration) {
+            for (int i = 0; i < 16; i++, iterations++) bytes += body();
+            elapsed = Clock::now() - start;
+        }
+        size_t allocs = Stats::Allocations() - allocsBefore;
+
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+        results.push_back({name, size, ns / iterations, double(bytes) / iterations, double(allocs) / iterations});
+
+        const Result& r = results.back();
+        std::fprintf(stderr, "%-28s %5zu %14.1f ns/op %12.0f B/op %8.2f allocs/op\n",
+            r.name.c_str(), r.size, r.nsPerOp, r.bytesPerOp, r.allocsPerOp);
+    }
+
+    /** All 16.7M colors are too many for a quick run, a fixed pseudo random sample is used instead. */
+    std::vector<Color::RGB> SampleColors(size_t count) {
+        std::vector<Color::RGB> colors(count);
+        uint32_t seed = 12345;
+        for (auto& c : colors) {
+            seed = seed * 1664525u + 1013904223u;
+            c = {uint8_t(seed >> 24), uint8_t(seed >> 16), uint8_t(seed >> 8)};
+        }
+        return colors;
+    }
+
+    /** Builds the same frame drawUI() does: both maps, selection, swatch, info and help text. */
+    void ComposeFrame(Render::CellGrid& frame, const Cache::ShadeMap& shademap, const Render::RenderBuffer& cachedHuemap,
+                      size_t size, size_t selected) {
+        Render::RenderBuffer huemap = cachedHuemap;
+        Render::RenderBuffer swatch{4, 8, {}};
+        Color::RGB color = Render::At(shademap.pixels, selected, selected);
+        Render::Fill(swatch, color);
+
+        Render::RenderBuffer cell{1, 1, {Color::RGB{255, 255, 255}}};
+        size_t mapRows = shademap.cells.height;
+
+        Render::Clear(frame, std::max<size_t>(size + 5, 64), mapRows + 5);
+        Render::BlitCells(frame, shademap.cells, 0, 0);
+        Render::BlitPixels(frame, Render::View(cell), selected, selected / 2);
+        Render::BlitPixels(frame, Render::View(huemap), size + 1, 0);
+        Render::BlitPixels(frame, Render::View(swatch), 0, mapRows);
+        Render::BlitText(frame, "RGB: 0 0 0\nHEX: #000000\nHSL: 0.00 0.00 0.00\nCMYK: 0.00 0.00 0.00 1.00", 5, mapRows);
+        Render::BlitText(frame, "(jk) Hue, (ws) Brightness, (ad) Saturation, (q/ENTER) Done", 0, mapRows + 4, {128, 128, 128});
+    }
+}
+
+// -------------------------------------------------------------
+// BENCHMARKS
+// -------------------------------------------------------------
+static void BenchColor() {
+    const size_t count = 4096;
+    auto rgb = SampleColors(count);
+    std::vector<Color::HSL> hsl(count);
+    std::vector<Color::CMYK> cmyk(count);
+    std::vector<Color::RGB> back(count);
+    Color::RGBtoHSL(hsl, rgb);
+
+    std::vector<std::string> hexStrings(count);
+    for (size_t i = 0; i < count; i++) Color::RGBtoHEX(hexStrings[i], rgb[i]);
+
+    Run("color/RGBtoHSL", 1, [&] {
+        static size_t i = 0;
+        Color::HSL out;
+        Color::RGBtoHSL(out, rgb[i++ % count]);
+        Keep(out);
+        return size_t(0);
+    });
+    Run("color/HSLtoRGB", 1, [&] {
+        static size_t i = 0;
+        Color::RGB out;
+        Color::HSLtoRGB(out, hsl[i++ % count]);
+        Keep(out);
+        return size_t(0);
+    });
+    Run("color/RGBtoHSL.batch", count, [&] {
+        Color::RGBtoHSL(hsl, rgb);
+        Keep(hsl[0]);
+        return size_t(0);
+    });
+    Run("color/HSLtoRGB.batch", count, [&] {
+        Color::HSLtoRGB(back, hsl);
+        Keep(back[0]);
+        return size_t(0);
+    });
+    Run("color/RGBtoCMYK.batch", count, [&] {
+        Color::RGBtoCMYK(cmyk, rgb);
+        Keep(cmyk[0]);
+        return size_t(0);
+    });
+    std::vector<Color::OKLab> oklab(count);
+    std::vector<Color::OKLCH> oklch(count);
+    Color::RGBtoOKLCH(oklch, rgb);
+    Run("color/RGBtoOKLab.batch", count, [&] {
+        Color::RGBtoOKLab(oklab, rgb);
+        Keep(oklab[0]);
+        return size_t(0);
+    });
+    Run("color/OKLCHtoRGB.batch", count, [&] {
+        Color::OKLCHtoRGB(back, oklch);
+        Keep(back[0]);
+        return size_t(0);
+    });
+    Run("color/RGBtoHEX", 1, [&] {
+        static size_t i = 0;
+        Color::HEX out;
+        Color::RGBtoHEX(out, rgb[i++ % count]);
+        Keep(out);
+        return out.size();
+    });
+    Run("color/HEXtoRGB", 1, [&] {
+        static size_t i = 0;
+        Color::RGB out;
+        Keep(Color::HEXtoRGB(out, hexStrings[i++ % count]));
+        Keep(out);
+        return size_t(0);
+    });
+    Run("color/EncodeHEX", 1, [&] {
+        static size_t i = 0;
+        char out[8];
+        size_t size = Color::EncodeHEX(out, rgb[i++ % count]);
+        Keep(out);
+        return size;
+    });
+    Run("color/DecodeHEX", 1, [&] {
+        static size_t i = 0;
+        Color::RGB out;
+        Keep(Color::DecodeHEX(out, hexStrings[i++ % count]));
+        Keep(out);
+        return size_t(0);
+    });
+    Run("convert/hex-to-hsl", count, [&] {
+        static std::string in, out;
+        if (in.empty()) for (auto& hex : hexStrings) in += hex + "\n";
+        out.clear();
+        Convert::ConvertLines(out, in, Color::Format::HEX, Template::ForFormat(Color::Format::HSL));
+        return out.size();
+    });
+    Template::Program program;
+    Template::Compile(program, "rgb({r}, {g}, {b}) {hex} {h:.1}");
+    Run("template/Format", 1, [&] {
+        static size_t i = 0;
+        char out[128];
+        size_t size = Template::Format(out, program, rgb[i++ % count]);
+        Keep(out);
+        return size;
+    });
+    Run("template/FormatLines", count, [&] {
+        static std::string out;
+        out.clear();
+        Template::FormatLines(out, program, rgb);
+        return out.size();
+    });
+}
+
+static void BenchRender(size_t size) {
+    Render::RenderBuffer shademap{size, size, {}};
+    Render::RenderBuffer huemap{4, size, {}};
+    Render::GenerateHueMap(huemap);
+
+    Run("render/GenerateShadeMap", size, [&] {
+        static float hue = 0.0f;
+        hue = hue >= 1.0f ? 0.0f : hue + 0.01f;
+        Render::GenerateShadeMap(shademap, hue);
+        return size_t(0);
+    });
+    Run("render/GenerateShadeMap.oklch", size, [&] {
+        static float hue = 0.0f;
+        hue = hue >= 1.0f ? 0.0f : hue + 0.01f;
+        Render::GenerateShadeMap(shademap, hue, Render::ShadeModel::OKLCH);
+        return size_t(0);
+    });
+
+    std::string ansi;
+    Run("render/RenderANSIString", size, [&] {
+        ansi.clear();
+        Render::RenderANSIString(ansi, shademap);
+        return ansi.size();
+    });
+
+    // The reduced color modes look colors up in the quantization tables instead of formatting RGB
+    const std::pair<Color::Mode, const char*> modes[] = {
+        {Color::Mode::Indexed256, "render/RenderANSIString.256"},
+        {Color::Mode::Indexed16, "render/RenderANSIString.16"},
+    };
+    for (const auto& [mode, name] : modes) {
+        Render::SetColorMode(mode);
+        Run(name, size, [&] {
+            ansi.clear();
+            Render::RenderANSIString(ansi, shademap);
+            return ansi.size();
+        });
+    }
+    Render::SetColorMode(Color::Mode::TrueColor);
+
+    // Packing more pixels per cell picks two colors per cell but leaves fewer cells and sequences to encode
+    const std::pair<Render::PixelMode, const char*> pixelModes[] = {
+        {Render::PixelMode::Quadrant, "render/RenderANSIString.quadrant"},
+        {Render::PixelMode::Sextant, "render/RenderANSIString.sextant"},
+        {Render::PixelMode::Braille, "render/RenderANSIString.braille"},
+    };
+    for (const auto& [mode, name] : pixelModes) {
+        shademap.mode = mode;
+        Run(name, size, [&] {
+            ansi.clear();
+            Render::RenderANSIString(ansi, shademap);
+            return ansi.size();
+        });
+    }
+    shademap.mode = Render::PixelMode::Half;
+
+    Cache::MapCache cache(4);
+    auto cached = cache.GetShadeMap(0.5f, size, size);
+    Render::CellGrid frame;
+    Run("render/Compose", size, [&] {
+        ComposeFrame(frame, *cached, huemap, size, size / 2);
+        return size_t(0);
+    });
+
+    // A full frame as drawn on start or after a resize: generate, compose and encode
+    std::string display;
+    Run("frame/Full", size, [&] {
+        static float hue = 0.0f;
+        hue = hue >= 1.0f ? 0.0f : hue + 0.01f;
+        Cache::ShadeMap map;
+        map.pixels = {size, size, {}};
+        Render::GenerateShadeMap(map.pixels, hue);
+        Render::Clear(map.cells, size, (size + 1) / 2);
+        Render::BlitPixels(map.cells, Render::View(map.pixels), 0, 0);
+
+        ComposeFrame(frame, map, huemap, size, size / 2);
+        display.clear();
+        Render::RenderCells(display, frame);
+        return display.size();
+    });
+
+    // A frame after moving the selection by one cell: cached map, compose and diff
+    Render::CellGrid previous, next;
+    ComposeFrame(previous, *cached, huemap, size, size / 2);
+    Run("frame/Diff", size, [&] {
+        ComposeFrame(next, *cached, huemap, size, size / 2 + 1);
+        display.clear();
+        Render::RenderDiff(display, previous, next);
+        return display.size();
+    });
+}
+
+static void BenchExtract() {
+    // A 1024x1024 PPM with a color per pixel, every pixel is visited once per histogram
+    const size_t side = 1024;
+    auto colors = SampleColors(side * side);
+    std::string file = "P6 1024 1024 255\n";
+    for (const auto& c : colors) file += {char(c.r), char(c.g), char(c.b)};
+
+    Extract::Image image;
+    Extract::ParseImage(image, file);
+    Extract::Histogram histogram;
+    Run("extract/BuildHistogram", side * side, [&] {
+        Extract::BuildHistogram(histogram, image);
+        return size_t(0);
+    });
+    Run("extract/MedianCut", 16, [&] {
+        auto swatches = Extract::MedianCut(histogram, 16);
+        Keep(swatches[0]);
+        return size_t(0);
+    });
+}
+
+static void BenchGradient() {
+    const size_t steps = 65536;
+    const Color::RGB stops[] = {{255, 0, 0}, {255, 255, 0}, {0, 0, 255}};
+    std::vector<Color::RGB> colors(steps);
+    std::string out;
+
+    const std::pair<Gradient::Space, const char*> spaces[] = {
+        {Gradient::Space::RGB, "gradient/rgb"},
+        {Gradient::Space::OKLCH, "gradient/oklch"},
+    };
+    for (const auto& [space, name] : spaces) {
+        Run(name, steps, [&] {
+            Gradient::Sample(colors, stops, space, 0, steps);
+            out.clear();
+            Template::FormatLines(out, Template::ForFormat(Color::Format::HEX), colors);
+            return out.size();
+        });
+    }
+}
+
+static void BenchContrast() {
+    const size_t count = 1024;
+    auto colors = SampleColors(count);
+    Contrast::Planes planes;
+    Contrast::Prepare(planes, colors);
+    std::vector<float> ratio(count), deltaE(count);
+
+    Run("contrast/Row", count, [&] {
+        Contrast::Row(ratio.data(), deltaE.data(), planes, 0, 0, count);
+        Keep(deltaE);
+        return size_t(0);
+    });
+    Run("contrast/DeltaE2000", 1, [&] {
+        float e = Contrast::DeltaE2000({planes.L[0], planes.a[0], planes.b[0]}, {planes.L[1], planes.a[1], planes.b[1]});
+        Keep(e);
+        return size_t(0);
+    });
+}
+
+static bool WriteJSON(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    out << "{\n  \"backend\": \"" << Color::BatchBackend() << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        char line[256];
+        std::snprintf(line, sizeof(line),
+            "    {\"name\": \"%s\", \"size\": %zu, \"ns_per_op\": %.2f, \"bytes_per_op\": %.1f, \"allocs_per_op\": %.3f}%s\n",
+            r.name.c_str(), r.size, r.nsPerOp, r.bytesPerOp, r.allocsPerOp, i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+    return bool(out);
+}
+
+int main(int argc, char* argv[]) {
+    std::string path = argc > 1 ? argv[1] : "build/bench.json";
+
+    Stats::CountAllocations(true);
+    std::fprintf(stderr, "batch backend: %s\n", Color::BatchBackend());
+    BenchColor();
+    BenchExtract();
+    BenchGradient();
+    BenchContrast();
+    for (size_t size : Sizes) BenchRender(size);
+
+    if (!WriteJSON(path)) {
+        std::cerr << "Could not write '" << path << "'!\n";
+        return 1;
+    }
+    std::cerr << "Results written to " << path << "\n";
+    return 0;
+}
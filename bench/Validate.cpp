@@ -0,0 +1,367 @@
+// Exhaustive check of the RGB<->HSL and RGB<->CMYK conversions. Run with `make validate`.
+// Every one of the 16.7M RGB colors is converted and back again through the float and the fixed point paths,
+// spread over all cores. Reports the largest error against a double precision reference, the largest channel
+// error after the round trip and how many colors did not come back unchanged.
+// The batch conversions are compared bit for bit against the single color functions over all colors, interleaved
+// and planar.
+// The CIEDE2000 reference is checked against the published test pairs of Sharma, Wu and Dalal, and the pair
+// kernels against the reference over all pairs of a 16 level per channel grid.
+
+#include "Color.h"
+#include "Contrast.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    /** What one path did over a range of colors. */
+    struct Report {
+        double maxError = 0.0;      // Largest difference of a converted channel to the reference, in percent
+        int maxDrift = 0;           // Largest difference of an RGB channel after the round trip
+        uint64_t failures = 0;      // Colors that did not come back unchanged
+        double seconds = 0.0;
+
+        void Merge(const Report& other) {
+            maxError = std::max(maxError, other.maxError);
+            maxDrift = std::max(maxDrift, other.maxDrift);
+            failures += other.failures;
+        }
+    };
+
+    struct Reference {
+        double hsl[3];      // h in turns
+        double cmyk[4];
+    };
+
+    /** The conversions in double precision, for measuring the error of the others. */
+    Reference Exact(const Color::RGB& in) {
+        double r = in.r / 255.0, g = in.g / 255.0, b = in.b / 255.0;
+        double max = std::max({r, g, b}), min = std::min({r, g, b}), delta = max - min;
+
+        Reference ref{};
+        ref.hsl[2] = (max + min) / 2.0;
+        if (delta > 0.0) {
+            double h;
+            if (in.r >= in.g && in.r >= in.b) h = std::fmod((g - b) / delta + 6.0, 6.0);
+            else if (in.g >= in.b) h = (b - r) / delta + 2.0;
+            else h = (r - g) / delta + 4.0;
+            ref.hsl[0] = h / 6.0;
+            ref.hsl[1] = delta / (1.0 - std::fabs(2.0 * ref.hsl[2] - 1.0));
+        }
+
+        ref.cmyk[3] = 1.0 - max;
+        if (max > 0.0) {
+            ref.cmyk[0] = (max - r) / max;
+            ref.cmyk[1] = (max - g) / max;
+            ref.cmyk[2] = (max - b) / max;
+        }
+        return ref;
+    }
+
+    /** Hues are compared around the circle, 0.999 and 0.001 are close. */
+    double HueError(double a, double b) {
+        double d = std::fabs(a - b);
+        return std::min(d, 1.0 - d);
+    }
+
+    int Drift(const Color::RGB& a, const Color::RGB& b) {
+        return std::max({std::abs(a.r - b.r), std::abs(a.g - b.g), std::abs(a.b - b.b)});
+    }
+
+    void Check(Report& report, const Color::RGB& in, const Color::RGB& back, double error) {
+        report.maxError = std::max(report.maxError, error * 100.0);
+        int drift = Drift(in, back);
+        report.maxDrift = std::max(report.maxDrift, drift);
+        if (drift != 0) report.failures++;
+    }
+
+    enum Path { FloatHSL, FixedHSL, FloatCMYK, FixedCMYK, PathCount };
+    const char* PathNames[PathCount] = {"hsl/float", "hsl/fixed", "cmyk/float", "cmyk/fixed"};
+
+    /** Check every color with red = r through one path. */
+    void CheckPlane(Report& report, Path path, uint8_t r) {
+        for (int g = 0; g < 256; g++) {
+            for (int b = 0; b < 256; b++) {
+                Color::RGB in{r, uint8_t(g), uint8_t(b)};
+                Color::RGB back;
+                Reference ref = Exact(in);
+
+                switch (path) {
+                    case FloatHSL: {
+                        Color::HSL hsl;
+                        Color::RGBtoHSL(hsl, in);
+                        Color::HSLtoRGB(back, hsl);
+                        double error = std::max({HueError(hsl.h, ref.hsl[0]),
+                            std::fabs(hsl.s - ref.hsl[1]), std::fabs(hsl.l - ref.hsl[2])});
+                        Check(report, in, back, error);
+                        break;
+                    }
+                    case FixedHSL: {
+                        Color::HSL16 hsl;
+                        Color::RGBtoHSL16(hsl, in);
+                        Color::HSL16toRGB(back, hsl);
+                        double error = std::max({HueError(hsl.h / 65536.0, ref.hsl[0]),
+                            std::fabs(hsl.s / 65535.0 - ref.hsl[1]), std::fabs(hsl.l / 65535.0 - ref.hsl[2])});
+                        Check(report, in, back, error);
+                        break;
+                    }
+                    case FloatCMYK: {
+                        Color::CMYK cmyk;
+                        Color::RGBtoCMYK(cmyk, in);
+                        Color::CMYKtoRGB(back, cmyk);
+                        double error = std::max({std::fabs(cmyk.c - ref.cmyk[0]), std::fabs(cmyk.m - ref.cmyk[1]),
+                            std::fabs(cmyk.y - ref.cmyk[2]), std::fabs(cmyk.k - ref.cmyk[3])});
+                        Check(report, in, back, error);
+                        break;
+                    }
+                    case FixedCMYK: {
+                        Color::CMYK16 cmyk;
+                        Color::RGBtoCMYK16(cmyk, in);
+                        Color::CMYK16toRGB(back, cmyk);
+                        double error = std::max({std::fabs(cmyk.c / 65535.0 - ref.cmyk[0]),
+                            std::fabs(cmyk.m / 65535.0 - ref.cmyk[1]), std::fabs(cmyk.y / 65535.0 - ref.cmyk[2]),
+                            std::fabs(cmyk.k / 65535.0 - ref.cmyk[3])});
+                        Check(report, in, back, error);
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+
+    void RoundTrip(Color::RGB& out, const Color::RGB& in, Color::HSL& space) {
+        Color::RGBtoHSL(space, in);
+        Color::HSLtoRGB(out, space);
+    }
+    void RoundTrip(Color::RGB& out, const Color::RGB& in, Color::HSL16& space) {
+        Color::RGBtoHSL16(space, in);
+        Color::HSL16toRGB(out, space);
+    }
+    void RoundTrip(Color::RGB& out, const Color::RGB& in, Color::CMYK& space) {
+        Color::RGBtoCMYK(space, in);
+        Color::CMYKtoRGB(out, space);
+    }
+    void RoundTrip(Color::RGB& out, const Color::RGB& in, Color::CMYK16& space) {
+        Color::RGBtoCMYK16(space, in);
+        Color::CMYK16toRGB(out, space);
+    }
+
+    volatile uint64_t sink;     // Keeps the timed loops from being optimized away
+
+    /** Time a round trip over all colors without the reference, so the paths can be compared. */
+    template <typename Space>
+    double TimeRoundTrip() {
+        std::vector<uint64_t> sums(256);
+        auto start = Clock::now();
+        Parallel::Pool().Run(256, [&](size_t r) {
+            uint64_t sum = 0;
+            for (int g = 0; g < 256; g++) {
+                for (int b = 0; b < 256; b++) {
+                    Color::RGB in{uint8_t(r), uint8_t(g), uint8_t(b)}, back;
+                    Space space;
+                    RoundTrip(back, in, space);
+                    sum += back.r + back.g + back.b;
+                }
+            }
+            sums[r] = sum;
+        });
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        for (uint64_t sum : sums) sink = sink + sum;
+        return seconds;
+    }
+}
+
+/** Compare the batch conversions with the single color functions for every color. Their results have to be
+bit-identical, a kernel that rounds differently would change colors depending on the cpu. Returns false on any
+difference. */
+static bool CheckBatch() {
+    enum Conversion { ToHSL, FromHSL, ToCMYK, FromCMYK, ConversionCount };
+    const char* names[] = {"RGBtoHSL", "HSLtoRGB", "RGBtoCMYK", "CMYKtoRGB"};
+
+    // One plane of 65536 colors with the same red per task, failures[r][conversion][interleaved, planar]
+    std::vector<uint64_t> failures(256 * ConversionCount * 2);
+    Parallel::Pool().Run(256, [&](size_t r) {
+        constexpr size_t Count = 256 * 256;
+        std::vector<Color::RGB> rgb(Count), rgbBatch(Count), back(Count);
+        std::vector<Color::HSL> hsl(Count), hslBatch(Count);
+        std::vector<Color::CMYK> cmyk(Count), cmykBatch(Count);
+        std::vector<uint8_t> red(Count), green(Count), blue(Count);
+        std::vector<float> planes[4];
+        for (std::vector<float>& plane : planes) plane.resize(Count);
+        uint64_t* counts = &failures[r * ConversionCount * 2];
+
+        for (size_t i = 0; i < Count; i++) {
+            rgb[i] = {uint8_t(r), uint8_t(i >> 8), uint8_t(i)};
+            red[i] = rgb[i].r;
+            green[i] = rgb[i].g;
+            blue[i] = rgb[i].b;
+            Color::RGBtoHSL(hsl[i], rgb[i]);
+            Color::RGBtoCMYK(cmyk[i], rgb[i]);
+        }
+        const Color::RGBPlanes in{red.data(), green.data(), blue.data()};
+        const Color::HSLPlanes hslPlanes{planes[0].data(), planes[1].data(), planes[2].data()};
+        const Color::CMYKPlanes cmykPlanes{planes[0].data(), planes[1].data(), planes[2].data(), planes[3].data()};
+        std::vector<uint8_t> outPlanes[3];
+        for (std::vector<uint8_t>& plane : outPlanes) plane.resize(Count);
+        const Color::RGBPlanes out{outPlanes[0].data(), outPlanes[1].data(), outPlanes[2].data()};
+
+        auto countRGB = [&](uint64_t& count, const Color::RGB* batch, const Color::HSL* fromHSL, const Color::CMYK* fromCMYK) {
+            for (size_t i = 0; i < Count; i++) {
+                Color::RGB scalar;
+                if (fromHSL) Color::HSLtoRGB(scalar, fromHSL[i]);
+                else Color::CMYKtoRGB(scalar, fromCMYK[i]);
+                Color::RGB got = batch ? batch[i] : Color::RGB{outPlanes[0][i], outPlanes[1][i], outPlanes[2][i]};
+                if (!(got == scalar)) ++count;
+            }
+        };
+
+        Color::RGBtoHSL(hslBatch, rgb);
+        for (size_t i = 0; i < Count; i++) counts[ToHSL * 2] += std::memcmp(&hslBatch[i], &hsl[i], sizeof(Color::HSL)) != 0;
+        Color::RGBtoHSL(hslPlanes, in, Count);
+        for (size_t i = 0; i < Count; i++) {
+            Color::HSL planar{planes[0][i], planes[1][i], planes[2][i]};
+            counts[ToHSL * 2 + 1] += std::memcmp(&planar, &hsl[i], sizeof(Color::HSL)) != 0;
+        }
+
+        // Back from the scalar results, so the inverse is checked on the values it is meant for
+        for (size_t i = 0; i < Count; i++) {
+            planes[0][i] = hsl[i].h;
+            planes[1][i] = hsl[i].s;
+            planes[2][i] = hsl[i].l;
+        }
+        Color::HSLtoRGB(rgbBatch, hsl);
+        countRGB(counts[FromHSL * 2], rgbBatch.data(), hsl.data(), nullptr);
+        Color::HSLtoRGB(out, hslPlanes, Count);
+        countRGB(counts[FromHSL * 2 + 1], nullptr, hsl.data(), nullptr);
+
+        Color::RGBtoCMYK(cmykBatch, rgb);
+        for (size_t i = 0; i < Count; i++) counts[ToCMYK * 2] += std::memcmp(&cmykBatch[i], &cmyk[i], sizeof(Color::CMYK)) != 0;
+        Color::RGBtoCMYK(cmykPlanes, in, Count);
+        for (size_t i = 0; i < Count; i++) {
+            Color::CMYK planar{planes[0][i], planes[1][i], planes[2][i], planes[3][i]};
+            counts[ToCMYK * 2 + 1] += std::memcmp(&planar, &cmyk[i], sizeof(Color::CMYK)) != 0;
+        }
+
+        for (size_t i = 0; i < Count; i++) {
+            planes[0][i] = cmyk[i].c;
+            planes[1][i] = cmyk[i].m;
+            planes[2][i] = cmyk[i].y;
+            planes[3][i] = cmyk[i].k;
+        }
+        Color::CMYKtoRGB(rgbBatch, cmyk);
+        countRGB(counts[FromCMYK * 2], rgbBatch.data(), nullptr, cmyk.data());
+        Color::CMYKtoRGB(out, cmykPlanes, Count);
+        countRGB(counts[FromCMYK * 2 + 1], nullptr, nullptr, cmyk.data());
+    });
+
+    uint64_t total = 0;
+    std::printf("\n%-12s %14s %12s  (%s)\n", "batch", "interleaved", "planar", Color::BatchBackend());
+    for (int conversion = 0; conversion < ConversionCount; conversion++) {
+        uint64_t interleaved = 0, planar = 0;
+        for (size_t r = 0; r < 256; r++) {
+            interleaved += failures[(r * ConversionCount + conversion) * 2];
+            planar += failures[(r * ConversionCount + conversion) * 2 + 1];
+        }
+        std::printf("%-12s %14llu %12llu\n", names[conversion], static_cast<unsigned long long>(interleaved),
+            static_cast<unsigned long long>(planar));
+        total += interleaved + planar;
+    }
+    return total == 0;
+}
+
+/** Check DeltaE2000 and the kernels of Contrast::Row. Returns false if either is off. */
+static bool CheckDeltaE() {
+    struct Pair {
+        Color::Lab x, y;
+        double expected;
+    };
+    const Pair pairs[] = {
+        {{50, 2.6772f, -79.7751f}, {50, 0, -82.7485f}, 2.0425},
+        {{50, 3.1571f, -77.2803f}, {50, 0, -82.7485f}, 2.8615},
+        {{50, 2.8361f, -74.02f}, {50, 0, -82.7485f}, 3.4412},
+        {{50, 0, 0}, {50, -1, 2}, 2.3669},
+        {{50, 2.5f, 0}, {50, 3.2972f, 0}, 1.0},
+        {{50, -0.001f, 2.49f}, {50, 0.0009f, -2.49f}, 4.8045},
+        {{50, 2.5f, 0}, {73, 25, -18}, 27.1492},
+        {{50, 2.5f, 0}, {61, -5, 29}, 22.8977},
+        {{50, 2.5f, 0}, {56, -27, -3}, 31.9030},
+        {{50, 2.5f, 0}, {58, 24, 15}, 19.4535},
+        {{60.2574f, -34.0099f, 36.2677f}, {60.4626f, -34.1751f, 39.4387f}, 1.2644},
+        {{22.7233f, 20.0904f, -46.694f}, {23.0331f, 14.973f, -42.5619f}, 2.0373},
+        {{2.0776f, 0.0795f, -1.135f}, {0.9033f, -0.0636f, -0.5514f}, 0.9082},
+    };
+    double referenceError = 0.0;
+    for (const Pair& pair : pairs) {
+        referenceError = std::max(referenceError, std::fabs(Contrast::DeltaE2000(pair.x, pair.y) - pair.expected));
+        referenceError = std::max(referenceError, std::fabs(Contrast::DeltaE2000(pair.y, pair.x) - pair.expected));
+    }
+
+    std::vector<Color::RGB> colors;
+    for (int r = 0; r < 256; r += 17)
+        for (int g = 0; g < 256; g += 17)
+            for (int b = 0; b < 256; b += 17) colors.push_back({uint8_t(r), uint8_t(g), uint8_t(b)});
+    Contrast::Planes planes;
+    Contrast::Prepare(planes, colors);
+
+    const size_t count = colors.size();
+    std::vector<double> rowErrors(count);
+    auto start = Clock::now();
+    Parallel::Pool().Run(count, [&](size_t i) {
+        std::vector<float> ratio(count), deltaE(count);
+        Contrast::Row(ratio.data(), deltaE.data(), planes, i, 0, count);
+        double error = 0.0;
+        for (size_t j = 0; j < count; j++) {
+            float exact = Contrast::DeltaE2000({planes.L[i], planes.a[i], planes.b[i]}, {planes.L[j], planes.a[j], planes.b[j]});
+            error = std::max(error, double(std::fabs(deltaE[j] - exact)));
+            if (ratio[j] != Contrast::Ratio(planes.luminance[i], planes.luminance[j])) error = INFINITY;
+        }
+        rowErrors[i] = error;
+    });
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double kernelError = *std::max_element(rowErrors.begin(), rowErrors.end());
+
+    std::printf("\n%-12s %14s %12s %12s\n", "deltaE", "max error", "tolerance", "pairs");
+    std::printf("%-12s %14.6f %12.4f %12zu\n", "reference", referenceError, 1e-4, std::size(pairs));
+    std::printf("%-12s %14.6f %12.4f %12zu  (%s, %.2f s with the reference)\n", "kernel", kernelError,
+        double(Contrast::RowTolerance), count * count, Color::BatchBackend(), seconds);
+    return referenceError < 1e-4 && kernelError < Contrast::RowTolerance;
+}
+
+int main() {
+    constexpr double Colors = 256.0 * 256.0 * 256.0;
+    std::fprintf(stderr, "checking %.0f colors on %zu threads\n", Colors, Parallel::Pool().Threads());
+
+    Report reports[PathCount];
+    for (int path = 0; path < PathCount; path++) {
+        std::vector<Report> planes(256);
+        Parallel::Pool().Run(256, [&](size_t r) { CheckPlane(planes[r], Path(path), uint8_t(r)); });
+        for (const Report& plane : planes) reports[path].Merge(plane);
+    }
+    reports[FloatHSL].seconds = TimeRoundTrip<Color::HSL>();
+    reports[FixedHSL].seconds = TimeRoundTrip<Color::HSL16>();
+    reports[FloatCMYK].seconds = TimeRoundTrip<Color::CMYK>();
+    reports[FixedCMYK].seconds = TimeRoundTrip<Color::CMYK16>();
+
+    std::printf("%-12s %14s %10s %12s %12s\n", "path", "max error %", "max drift", "failures", "ns/color");
+    for (int path = 0; path < PathCount; path++) {
+        const Report& r = reports[path];
+        std::printf("%-12s %14.6f %10d %12llu %12.2f\n", PathNames[path], r.maxError, r.maxDrift,
+            static_cast<unsigned long long>(r.failures), r.seconds * 1e9 / Colors * Parallel::Pool().Threads());
+    }
+
+    bool batch = CheckBatch();
+    bool deltaE = CheckDeltaE();
+
+    // The float paths are only reported, the fixed point ones and the batch conversions have to be exact
+    return reports[FixedHSL].failures == 0 && reports[FixedCMYK].failures == 0 && batch && deltaE ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#include "Cache.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace Cache;
+
+size_t MapCache::KeyHash::operator()(const Key& key) const {
+    size_t hash = key.hueBits;
+    hash = hash * 31 + key.width;
+    hash = hash * 31 + key.height;
+    hash = hash * 31 + key.viewport.zoom;
+    hash = hash * 31 + key.viewport.x;
+    hash = hash * 31 + key.viewport.y;
+    return hash;
+}
+
+size_t MapCache::KeyHash::operator()(const TileKey& key) const {
+    size_t hash = key.hueBits;
+    hash = hash * 31 + key.mapWidth;
+    hash = hash * 31 + key.mapHeight;
+    hash = hash * 31 + key.x;
+    hash = hash * 31 + key.y;
+    return hash;
+}
+
+// A few screens worth of tiles for every cached view
+MapCache::MapCache(size_t capacity) : capacity(capacity > 0 ? capacity : 1), tileCapacity(this->capacity * 16) {
+    hueMap.pixels = {0, 0, {}};
+}
+
+MapCache::~MapCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (worker.joinable()) worker.join();
+}
+
+MapCache::Key MapCache::MakeKey(float hue, size_t width, size_t height, const Viewport& viewport) {
+    Key key{0, width, height, viewport};
+    memcpy(&key.hueBits, &hue, sizeof(hue));
+    return key;
+}
+
+std::shared_ptr<const ShadeMap> MapCache::Generate(const Key& key) {
+    float hue;
+    memcpy(&hue, &key.hueBits, sizeof(hue));
+
+    auto map = std::make_shared<ShadeMap>();
+    map->pixels = {key.width, key.height, {}, pixelMode};
+    if (key.viewport.zoom == 0) {
+        // An empty map still gets its pixels, so the cells below never read past them
+        if (!Render::GenerateShadeMap(map->pixels, hue, model)) map->pixels.pixels.assign(key.width * key.height, {});
+    } else {
+        // Copy the view together from the tiles it overlaps
+        map->pixels.pixels.resize(key.width * key.height);
+        const Viewport& view = key.viewport;
+        size_t mapWidth = key.width << view.zoom, mapHeight = key.height << view.zoom;
+        for (size_t ty = view.y / TileSize * TileSize; ty < view.y + key.height; ty += TileSize) {
+            for (size_t tx = view.x / TileSize * TileSize; tx < view.x + key.width; tx += TileSize) {
+                auto tile = GetTile({key.hueBits, mapWidth, mapHeight, tx, ty});
+
+                size_t left = std::max(tx, view.x), right = std::min(tx + tile->width, view.x + key.width);
+                size_t top = std::max(ty, view.y), bottom = std::min(ty + tile->height, view.y + key.height);
+                for (size_t y = top; y < bottom; y++) {
+                    const Render::Pixel* src = &Render::At(*tile, left - tx, y - ty);
+                    std::copy(src, src + (right - left), &Render::At(map->pixels, left - view.x, y - view.y));
+                }
+            }
+        }
+    }
+
+    Render::Clear(map->cells, Render::CellsAcross(key.width, pixelMode), Render::CellsDown(key.height, pixelMode));
+    Render::BlitPixels(map->cells, Render::View(map->pixels), 0, 0);
+    return map;
+}
+
+std::shared_ptr<const Render::RenderBuffer> MapCache::GetTile(const TileKey& key) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = tileIndex.find(key);
+        if (found != tileIndex.end()) {
+            tiles.splice(tiles.begin(), tiles, found->second);
+            return found->second->second;
+        }
+    }
+
+    float hue;
+    memcpy(&hue, &key.hueBits, sizeof(hue));
+    auto tile = std::make_shared<Render::RenderBuffer>();
+    *tile = {std::min(TileSize, key.mapWidth - key.x), std::min(TileSize, key.mapHeight - key.y), {}};
+    if (!Render::GenerateShadeRegion(*tile, hue, key.mapWidth, key.mapHeight, key.x, key.y, model)) {
+        tile->pixels.assign(tile->width * tile->height, {});
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = tileIndex.find(key);
+    if (found != tileIndex.end()) return found->second->second;
+
+    tiles.emplace_front(key, std::move(tile));
+    tileIndex[key] = tiles.begin();
+    if (tiles.size() > tileCapacity) {
+        tileIndex.erase(tiles.back().first);
+        tiles.pop_back();
+    }
+    return tiles.front().second;
+}
+
+std::shared_ptr<const ShadeMap> MapCache::Insert(const Key& key, std::shared_ptr<const ShadeMap> map) {
+    auto found = index.find(key);
+    if (found != index.end()) return found->second->second;
+
+    entries.emplace_front(key, std::move(map));
+    index[key] = entries.begin();
+
+    if (entries.size() > capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+    return entries.front().second;
+}
+
+std::shared_ptr<const ShadeMap> MapCache::GetShadeMap(float hue, size_t width, size_t height, const Viewport& viewport) {
+    Key key = MakeKey(hue, width, height, viewport);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+        if (found != index.end()) {
+            entries.splice(entries.begin(), entries, found->second);
+            return found->second->second;
+        }
+    }
+
+    // Miss: generate without holding the lock so the worker can keep going
+    auto map = Generate(key);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return Insert(key, std::move(map));
+}
+
+const HueMap& MapCache::GetHueMap(size_t width, size_t height) {
+    if (hueMap.pixels.width == width && hueMap.pixels.height == height) return hueMap;
+
+    hueMap.pixels = {width, height, {}, pixelMode};
+    Render::GenerateHueMap(hueMap.pixels, model);
+
+    hueMap.rowHues.resize(height);
+    if (model == Render::ShadeModel::OKLCH) {
+        // Converting the pixels back would give OKLCH hues on a different scale, use the generated ones
+        float hue = 0.0f;
+        for (size_t y = 0; y < height; y++, hue += 1.0f / height) hueMap.rowHues[y] = hue;
+        return hueMap;
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        Color::HSL hsl;
+        Color::RGBtoHSL(hsl, Render::At(hueMap.pixels, 0, y));
+        hueMap.rowHues[y] = hsl.h;
+    }
+    return hueMap;
+}
+
+void MapCache::Prefetch(std::span<const float> hues, size_t width, size_t height, const Viewport& viewport) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.clear();
+        for (float hue : hues) {
+            Key key = MakeKey(hue, width, height, viewport);
+            if (!index.count(key)) pending.push_back(key);
+        }
+        if (pending.empty()) return;
+        if (!worker.joinable()) worker = std::thread(&MapCache::Work, this);
+    }
+    wake.notify_one();
+}
+
+void MapCache::Work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (stopping) return;
+
+        Key key = pending.front();
+        pending.erase(pending.begin());
+        if (index.count(key)) continue;
+
+        lock.unlock();
+        auto map = Generate(key);
+        lock.lock();
+
+        Insert(key, std::move(map));
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Render.h"
+
+namespace Cache {
+
+    /** A generated shade map together with its cells, packed by Render::BlitPixels in the map's pixel mode. */
+    struct ShadeMap {
+        Render::RenderBuffer pixels;
+        Render::CellGrid cells;
+    };
+
+    /** The part of a magnified shade map that is shown. The whole map is (width << zoom) x (height << zoom) pixels
+    for a width x height view, the view starts at (x, y) of it. Zoom 0 shows the whole map. */
+    struct Viewport {
+        unsigned zoom = 0;
+        size_t x = 0;
+        size_t y = 0;
+
+        bool operator==(const Viewport&) const = default;
+    };
+
+    /** Pixels per side of the tiles magnified maps are generated in. */
+    constexpr size_t TileSize = 32;
+
+    /** A generated hue map and the hue every row converts back to. */
+    struct HueMap {
+        Render::RenderBuffer pixels;
+        std::vector<float> rowHues;
+    };
+
+    /** LRU cache of shade maps keyed by (hue, width, height, viewport), plus the hue map which only depends on its size.
+    Magnified views are put together from tiles of TileSize pixels that are cached on their own, so panning
+    and zooming only generate the tiles that come into view.
+    A background worker generates prefetched shade maps so they are ready before they are asked for. */
+    class MapCache {
+    private:
+        struct Key {
+            uint32_t hueBits;
+            size_t width;
+            size_t height;
+            Viewport viewport;
+
+            bool operator==(const Key&) const = default;
+        };
+
+        /** A tile at (x, y) of a whole mapWidth x mapHeight map. */
+        struct TileKey {
+            uint32_t hueBits;
+            size_t mapWidth;
+            size_t mapHeight;
+            size_t x;
+            size_t y;
+
+            bool operator==(const TileKey&) const = default;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
+            size_t operator()(const TileKey& key) const;
+        };
+
+        typedef std::pair<Key, std::shared_ptr<const ShadeMap>> Entry;
+        typedef std::pair<TileKey, std::shared_ptr<const Render::RenderBuffer>> TileEntry;
+
+        size_t capacity;
+        std::list<Entry> entries; // Most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+
+        size_t tileCapacity;
+        std::list<TileEntry> tiles; // Most recently used first
+        std::unordered_map<TileKey, std::list<TileEntry>::iterator, KeyHash> tileIndex;
+
+        std::vector<Key> pending;
+        bool stopping = false;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::thread worker;
+
+        HueMap hueMap;
+        Render::ShadeModel model = Render::ShadeModel::HSL;
+        Render::PixelMode pixelMode = Render::PixelMode::Half;
+
+        static Key MakeKey(float hue, size_t width, size_t height, const Viewport& viewport);
+        std::shared_ptr<const ShadeMap> Generate(const Key& key);
+
+        /** Get a tile from the tile cache or generate it. Takes the mutex itself. */
+        std::shared_ptr<const Render::RenderBuffer> GetTile(const TileKey& key);
+
+        /** Insert a map unless another thread got there first. mutex must be held. Returns the cached map. */
+        std::shared_ptr<const ShadeMap> Insert(const Key& key, std::shared_ptr<const ShadeMap> map);
+
+        void Work();
+    public:
+        explicit MapCache(size_t capacity);
+        ~MapCache();
+
+        MapCache(const MapCache&) = delete;
+        MapCache& operator=(const MapCache&) = delete;
+
+        /** Set the color model maps are generated in. Only call this before the first map is requested. */
+        void SetModel(Render::ShadeModel shadeModel) { model = shadeModel; }
+
+        /** Set how the maps pack their pixels into cells. Only call this before the first map is requested. */
+        void SetPixelMode(Render::PixelMode mode) { pixelMode = mode; }
+
+        /** Get the shade map for a hue, generating it on the calling thread if it is not cached yet.
+        With a zoomed viewport only its part of the magnified map is returned, width x height pixels. */
+        std::shared_ptr<const ShadeMap> GetShadeMap(float hue, size_t width, size_t height, const Viewport& viewport = {});
+
+        /** Get the hue map of the given size. Only call this from one thread. */
+        const HueMap& GetHueMap(size_t width, size_t height);
+
+        /** Replace the worker's queue with these hues, nearest first. */
+        void Prefetch(std::span<const float> hues, size_t width, size_t height, const Viewport& viewport = {});
+    };
+}
@@ -1,8 +1,9 @@
 #include "Color.h"
 #include <cmath>
 #include <algorithm>
-#include <sstream>
-#include <iomanip>
+#include <array>
+#include <bit>
+#include <cstring>
 
 void Color::RGBtoHSL(HSL& out, const RGB& in) {
     float rf = in.r / 255.0f;
@@ -63,35 +64,85 @@ void Color::HSLtoRGB(RGB& out, const HSL& in) {
 }
 
 
-void Color::RGBtoHEX(HEX& out, const RGB& in) {
-    std::ostringstream oss;
-    oss << '#' 
-        << std::hex << std::uppercase << std::setfill('0') 
-        << std::setw(2) << static_cast<int>(in.r) 
-        << std::setw(2) << static_cast<int>(in.g) 
-        << std::setw(2) << static_cast<int>(in.b);
-    out = oss.str();
+namespace {
+
+    /** Value of every hex digit, -1 for all other chars. */
+    constexpr auto HexValues = [] {
+        std::array<int8_t, 256> table{};
+        table.fill(-1);
+        for (int i = 0; i < 10; i++) table['0' + i] = static_cast<int8_t>(i);
+        for (int i = 0; i < 6; i++) {
+            table['a' + i] = static_cast<int8_t>(10 + i);
+            table['A' + i] = static_cast<int8_t>(10 + i);
+        }
+        return table;
+    }();
+
+    /** Two upper case hex digits for every byte value. */
+    constexpr auto HexPairs = [] {
+        constexpr char digits[] = "0123456789ABCDEF";
+        std::array<std::array<char, 2>, 256> table{};
+        for (int i = 0; i < 256; i++) table[i] = {digits[i >> 4], digits[i & 0xF]};
+        return table;
+    }();
+
+    /** Combine two hex digits to a byte, returns -1 if either is not a hex digit. */
+    int HexByte(char hi, char lo) {
+        int h = HexValues[static_cast<uint8_t>(hi)];
+        int l = HexValues[static_cast<uint8_t>(lo)];
+        return (h | l) < 0 ? -1 : h << 4 | l;
+    }
 }
 
-bool Color::HEXtoRGB(RGB& out, const HEX& in) {
-    HEX cleanHex = in;
-    if (cleanHex.size() == 7 && cleanHex[0] == '#') {
-        cleanHex = cleanHex.substr(1);
-    } else if (cleanHex.size() != 6) {
-        return false;
+size_t Color::EncodeHEX(char (&out)[8], const RGB& in) {
+    out[0] = '#';
+    memcpy(out + 1, HexPairs[in.r].data(), 2);
+    memcpy(out + 3, HexPairs[in.g].data(), 2);
+    memcpy(out + 5, HexPairs[in.b].data(), 2);
+    out[7] = '\0';
+    return 7;
+}
+
+bool Color::DecodeHEX(RGB& out, std::string_view in, uint8_t* alpha) {
+    if (!in.empty() && in[0] == '#') {
+        in.remove_prefix(1);
+    } else if (in.size() > 2 && in[0] == '0' && (in[1] == 'x' || in[1] == 'X')) {
+        in.remove_prefix(2);
     }
 
-    try {
-        out.r = static_cast<uint8_t>(std::stoi(cleanHex.substr(0, 2), nullptr, 16));
-        out.g = static_cast<uint8_t>(std::stoi(cleanHex.substr(2, 2), nullptr, 16));
-        out.b = static_cast<uint8_t>(std::stoi(cleanHex.substr(4, 2), nullptr, 16));
-    } catch (...) {
-        return false;
+    int channels[4] = {0, 0, 0, 255};
+    switch (in.size()) {
+        case 3: // Shorthand, every digit is doubled
+            for (size_t i = 0; i < 3; i++) channels[i] = HexByte(in[i], in[i]);
+            break;
+        case 8:
+            channels[3] = HexByte(in[6], in[7]);
+            [[fallthrough]];
+        case 6:
+            for (size_t i = 0; i < 3; i++) channels[i] = HexByte(in[i * 2], in[i * 2 + 1]);
+            break;
+        default:
+            return false;
     }
 
+    if ((channels[0] | channels[1] | channels[2] | channels[3]) < 0) return false;
+
+    out.r = static_cast<uint8_t>(channels[0]);
+    out.g = static_cast<uint8_t>(channels[1]);
+    out.b = static_cast<uint8_t>(channels[2]);
+    if (alpha) *alpha = static_cast<uint8_t>(channels[3]);
     return true;
 }
 
+void Color::RGBtoHEX(HEX& out, const RGB& in) {
+    char hex[8];
+    out.assign(hex, EncodeHEX(hex, in));
+}
+
+bool Color::HEXtoRGB(RGB& out, const HEX& in) {
+    return DecodeHEX(out, in);
+}
+
 void Color::RGBtoCMYK(CMYK& out, const RGB& in) {
     float rf = in.r / 255.0f;
     float gf = in.g / 255.0f;
@@ -115,10 +166,840 @@ void Color::CMYKtoRGB(RGB& out, const CMYK& in) {
     out.b = static_cast<int>(255 * (1 - in.y) * (1 - in.k));
 }
 
-Color::ANSI Color::RGBtoANSI(const RGB& in, bool fg) {
+// -------------------------------------------------------------
+// FIXED POINT HSL AND CMYK
+// -------------------------------------------------------------
+namespace {
+
+    constexpr uint64_t Unit = 65535;        // 1.0 for s, l and the CMYK channels
+    constexpr uint64_t Turn = 65536;        // A full turn of hue
+
+    /** a / b rounded to nearest, halves up. */
+    constexpr uint64_t DivRound(uint64_t a, uint64_t b) {
+        return (a + b / 2) / b;
+    }
+
+    /** Unit / max in 32.32 fixed point for every max, so RGBtoCMYK16 multiplies instead of dividing. */
+    constexpr auto CMYKScale = [] {
+        std::array<uint64_t, 256> table{};
+        for (uint64_t max = 1; max < 256; max++) table[max] = DivRound(Unit << 32, max);
+        return table;
+    }();
+
+    uint16_t ScaleRound(uint64_t value, uint64_t scale) {
+        return static_cast<uint16_t>((value * scale + (uint64_t(1) << 31)) >> 32);
+    }
+}
+
+void Color::RGBtoHSL16(HSL16& out, const RGB& in) {
+    int max = std::max({in.r, in.g, in.b});
+    int min = std::min({in.r, in.g, in.b});
+    int delta = max - min;
+    int sum = max + min;
+
+    out.l = static_cast<uint16_t>(DivRound(sum * Unit, 510));
+    if (delta == 0) {
+        out.h = out.s = 0;
+        return;
+    }
+
+    // Distance from the lighter or the darker end, 1 - |2l - 1| in 1/255
+    int range = sum <= 255 ? sum : 510 - sum;
+    out.s = static_cast<uint16_t>(DivRound(delta * Unit, range));
+
+    // Hue in sixths of a turn times delta, so the division happens once at the end
+    int sixths;
+    if (max == in.r) sixths = in.g - in.b;
+    else if (max == in.g) sixths = in.b - in.r + 2 * delta;
+    else sixths = in.r - in.g + 4 * delta;
+    if (sixths < 0) sixths += 6 * delta;
+    out.h = static_cast<uint16_t>(DivRound(sixths * Turn, 6 * delta) % Turn);
+}
+
+void Color::HSL16toRGB(RGB& out, const HSL16& in) {
+    // Everything is kept in units of 1 / (2 * Unit^2 * Turn) so nothing is rounded before the end
+    constexpr uint64_t Scale = 2 * Unit * Unit * Turn;
+
+    uint64_t twoL = 2 * uint64_t(in.l);
+    uint64_t chroma = (Unit - (twoL > Unit ? twoL - Unit : Unit - twoL)) * in.s;   // In 1 / Unit^2
+
+    uint64_t h6 = uint64_t(in.h) * 6;
+    uint64_t sector = h6 / Turn;
+    uint64_t inSector = (sector & 1) * Turn + h6 % Turn;                            // h mod 2 in 1 / Turn
+    uint64_t ramp = Turn - (inSector > Turn ? inSector - Turn : Turn - inSector);
+
+    uint64_t c = chroma * 2 * Turn;
+    uint64_t x = chroma * 2 * ramp;
+    uint64_t m = (in.l * Unit * 2 - chroma) * Turn;
+
+    uint64_t rf = 0, gf = 0, bf = 0;
+    switch (sector) {
+        case 0: rf = c; gf = x; break;
+        case 1: rf = x; gf = c; break;
+        case 2: gf = c; bf = x; break;
+        case 3: gf = x; bf = c; break;
+        case 4: rf = x; bf = c; break;
+        default: rf = c; bf = x; break;
+    }
+
+    out.r = static_cast<uint8_t>(DivRound((rf + m) * 255, Scale));
+    out.g = static_cast<uint8_t>(DivRound((gf + m) * 255, Scale));
+    out.b = static_cast<uint8_t>(DivRound((bf + m) * 255, Scale));
+}
+
+void Color::RGBtoCMYK16(CMYK16& out, const RGB& in) {
+    int max = std::max({in.r, in.g, in.b});
+    if (max == 0) {
+        out = {0, 0, 0, static_cast<uint16_t>(Unit)}; // Pure black
+        return;
+    }
+
+    // (1 - channel - k) / (1 - k) is (max - channel) / max
+    uint64_t scale = CMYKScale[max];
+    out.k = static_cast<uint16_t>(DivRound((255 - max) * Unit, 255));
+    out.c = ScaleRound(max - in.r, scale);
+    out.m = ScaleRound(max - in.g, scale);
+    out.y = ScaleRound(max - in.b, scale);
+}
+
+void Color::CMYK16toRGB(RGB& out, const CMYK16& in) {
+    uint64_t white = Unit - in.k;
+    out.r = static_cast<uint8_t>(DivRound(255 * (Unit - in.c) * white, Unit * Unit));
+    out.g = static_cast<uint8_t>(DivRound(255 * (Unit - in.m) * white, Unit * Unit));
+    out.b = static_cast<uint8_t>(DivRound(255 * (Unit - in.y) * white, Unit * Unit));
+}
+
+// -------------------------------------------------------------
+// PERCEPTUAL COLOR SPACES
+// -------------------------------------------------------------
+namespace {
+
+    /** sRGB transfer function and its inverse on doubles, only used to fill the tables. */
+    double DecodeTransfer(double c) {
+        return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+    }
+
+    struct TransferTables {
+        float linear[256];      // Linear light of every sRGB byte
+        float threshold[255];   // Linear light halfway between byte i and i + 1 (in sRGB), for rounding back
+    };
+
+    const TransferTables Transfer = [] {
+        TransferTables tables{};
+        for (int i = 0; i < 256; i++) tables.linear[i] = static_cast<float>(DecodeTransfer(i / 255.0));
+        for (int i = 0; i < 255; i++) tables.threshold[i] = static_cast<float>(DecodeTransfer((i + 0.5) / 255.0));
+        return tables;
+    }();
+
+    /** Number of thresholds at or below the value, found by a branch free binary search. */
+    inline uint8_t EncodeLinear(float value) {
+        size_t index = 0;
+        for (size_t step = 128; step > 0; step >>= 1) {
+            size_t probe = index + step;
+            index = (probe <= 255 && Transfer.threshold[probe - 1] <= value) ? probe : index;
+        }
+        return static_cast<uint8_t>(index);
+    }
+
+    constexpr float Cbrt(float x) {
+        if (x == 0.0f) return 0.0f;
+        float a = x < 0.0f ? -x : x;
+
+        // Dividing the exponent bits by three gives a first guess within a few percent
+        uint32_t bits = std::bit_cast<uint32_t>(a);
+        float y = std::bit_cast<float>(bits / 3 + 0x2A5137A0u);
+
+        // Halley's method triples the correct digits per step
+        for (int i = 0; i < 2; i++) {
+            float y3 = y * y * y;
+            y = y * (y3 + 2.0f * a) / (2.0f * y3 + a);
+        }
+        return x < 0.0f ? -y : y;
+    }
+
+    /** Largest relative error of Cbrt over values from 1e-6 (darker than any 8-bit color) to 8,
+    checked at compile time. */
+    constexpr double CbrtError() {
+        double worst = 0.0;
+        for (double x = 1e-6; x < 8.0; x *= 1.01) {
+            double y = Cbrt(static_cast<float>(x));
+            double error = (y * y * y - static_cast<float>(x)) / static_cast<float>(x);
+            error = error < 0 ? -error : error;
+            worst = error > worst ? error : worst;
+        }
+        return worst / 3.0; // The cube triples the relative error of the root
+    }
+    static_assert(CbrtError() < 1e-6, "FastCbrt lost accuracy");
+
+    inline void LinearToOKLab(Color::OKLab& out, float r, float g, float b) {
+        float l = Cbrt(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+        float m = Cbrt(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+        float s = Cbrt(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+
+        out.L = 0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s;
+        out.a = 1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s;
+        out.b = 0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s;
+    }
+
+    inline void OKLabToLinear(const Color::OKLab& in, float& r, float& g, float& b) {
+        float l = in.L + 0.3963377774f * in.a + 0.2158037573f * in.b;
+        float m = in.L - 0.1055613458f * in.a - 0.0638541728f * in.b;
+        float s = in.L - 0.0894841775f * in.a - 1.2914855480f * in.b;
+        l = l * l * l;
+        m = m * m * m;
+        s = s * s * s;
+
+        r = +4.0767416621f * l - 3.3077115913f * m + 0.2309699292f * s;
+        g = -1.2684380046f * l + 2.6097574011f * m - 0.3413193965f * s;
+        b = -0.0041960863f * l - 0.7034186147f * m + 1.7076147010f * s;
+    }
+
+    constexpr float Pi = 3.14159265358979f;
+
+    inline void PolarToOKLab(Color::OKLab& out, const Color::OKLCH& in) {
+        float angle = in.h * (Pi / 180.0f);
+        out = {in.L, in.C * std::cos(angle), in.C * std::sin(angle)};
+    }
+
+    constexpr float AchromaticChroma = 1e-5f;   // Below this a and b are rounding noise of a gray
+
+    inline void OKLabToPolar(Color::OKLCH& out, const Color::OKLab& in) {
+        float chroma = std::sqrt(in.a * in.a + in.b * in.b);
+        if (chroma < AchromaticChroma) {
+            // Grays have no hue, report 0 instead of the angle of the noise
+            out = {in.L, 0.0f, 0.0f};
+            return;
+        }
+        float h = std::atan2(in.b, in.a) * (180.0f / Pi);
+        out = {in.L, chroma, h < 0.0f ? h + 360.0f : h};
+    }
+
+    // CIELAB with the D65 white point
+    constexpr float WhiteX = 0.95047f, WhiteZ = 1.08883f;
+    constexpr float LabEpsilon = 216.0f / 24389.0f;   // (6/29)^3
+    constexpr float LabKappa = 24389.0f / 27.0f;      // (29/3)^3
+
+    inline float LabF(float t) {
+        return t > LabEpsilon ? Cbrt(t) : (LabKappa * t + 16.0f) / 116.0f;
+    }
+
+    inline float LabFInverse(float f) {
+        float t = f * f * f;
+        return t > LabEpsilon ? t : (116.0f * f - 16.0f) / LabKappa;
+    }
+
+    inline void LinearToLab(Color::Lab& out, float r, float g, float b) {
+        float x = (0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / WhiteX;
+        float y = 0.2126729f * r + 0.7151522f * g + 0.0721750f * b;
+        float z = (0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / WhiteZ;
+
+        float fx = LabF(x), fy = LabF(y), fz = LabF(z);
+        out = {116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz)};
+    }
+
+    inline void LabToLinear(const Color::Lab& in, float& r, float& g, float& b) {
+        float fy = (in.L + 16.0f) / 116.0f;
+        float x = LabFInverse(fy + in.a / 500.0f) * WhiteX;
+        float y = LabFInverse(fy);
+        float z = LabFInverse(fy - in.b / 200.0f) * WhiteZ;
+
+        r = 3.2404542f * x - 1.5371385f * y - 0.4985314f * z;
+        g = -0.9692660f * x + 1.8760108f * y + 0.0415560f * z;
+        b = 0.0556434f * x - 0.2040259f * y + 1.0572252f * z;
+    }
+
+    inline void RGBToOKLabInline(Color::OKLab& out, const Color::RGB& in) {
+        LinearToOKLab(out, Transfer.linear[in.r], Transfer.linear[in.g], Transfer.linear[in.b]);
+    }
+
+    inline void OKLabToRGBInline(Color::RGB& out, const Color::OKLab& in) {
+        float r, g, b;
+        OKLabToLinear(in, r, g, b);
+        out = {EncodeLinear(r), EncodeLinear(g), EncodeLinear(b)};
+    }
+
+    inline void RGBToLabInline(Color::Lab& out, const Color::RGB& in) {
+        LinearToLab(out, Transfer.linear[in.r], Transfer.linear[in.g], Transfer.linear[in.b]);
+    }
+
+    inline void LabToRGBInline(Color::RGB& out, const Color::Lab& in) {
+        float r, g, b;
+        LabToLinear(in, r, g, b);
+        out = {EncodeLinear(r), EncodeLinear(g), EncodeLinear(b)};
+    }
+}
+
+float Color::SRGBtoLinear(uint8_t in) {
+    return Transfer.linear[in];
+}
+
+uint8_t Color::LinearToSRGB(float in) {
+    return EncodeLinear(in);
+}
+
+float Color::FastCbrt(float x) {
+    return Cbrt(x);
+}
+
+void Color::RGBtoOKLab(OKLab& out, const RGB& in) {
+    RGBToOKLabInline(out, in);
+}
+
+void Color::OKLabtoRGB(RGB& out, const OKLab& in) {
+    OKLabToRGBInline(out, in);
+}
+
+void Color::OKLabtoOKLCH(OKLCH& out, const OKLab& in) {
+    OKLabToPolar(out, in);
+}
+
+void Color::OKLCHtoOKLab(OKLab& out, const OKLCH& in) {
+    PolarToOKLab(out, in);
+}
+
+void Color::RGBtoOKLCH(OKLCH& out, const RGB& in) {
+    OKLab lab;
+    RGBToOKLabInline(lab, in);
+    OKLabToPolar(out, lab);
+}
+
+void Color::OKLCHtoRGB(RGB& out, const OKLCH& in) {
+    OKLab lab;
+    PolarToOKLab(lab, in);
+    OKLabToRGBInline(out, lab);
+}
+
+void Color::RGBtoLab(Lab& out, const RGB& in) {
+    RGBToLabInline(out, in);
+}
+
+void Color::LabtoRGB(RGB& out, const Lab& in) {
+    LabToRGBInline(out, in);
+}
+
+float Color::MaxChroma(float L, float h) {
+    // Chroma is in gamut up to a single boundary, bisect for it
+    constexpr float Tolerance = 1.0f / 255.0f / 8.0f;
+    float low = 0.0f, high = 0.4f;
+    for (int i = 0; i < 16; i++) {
+        float C = (low + high) * 0.5f;
+        OKLab lab;
+        PolarToOKLab(lab, {L, C, h});
+        float r, g, b;
+        OKLabToLinear(lab, r, g, b);
+
+        bool inside = r >= -Tolerance && r <= 1.0f + Tolerance &&
+                      g >= -Tolerance && g <= 1.0f + Tolerance &&
+                      b >= -Tolerance && b <= 1.0f + Tolerance;
+        (inside ? low : high) = C;
+    }
+    return low;
+}
+
+void Color::RGBtoOKLab(std::span<OKLab> out, std::span<const RGB> in) {
+    size_t count = std::min(out.size(), in.size());
+    for (size_t i = 0; i < count; i++) RGBToOKLabInline(out[i], in[i]);
+}
+
+void Color::OKLabtoRGB(std::span<RGB> out, std::span<const OKLab> in) {
+    size_t count = std::min(out.size(), in.size());
+    for (size_t i = 0; i < count; i++) OKLabToRGBInline(out[i], in[i]);
+}
+
+void Color::RGBtoOKLCH(std::span<OKLCH> out, std::span<const RGB> in) {
+    size_t count = std::min(out.size(), in.size());
+    for (size_t i = 0; i < count; i++) {
+        OKLab lab;
+        RGBToOKLabInline(lab, in[i]);
+        OKLabToPolar(out[i], lab);
+    }
+}
+
+void Color::OKLCHtoRGB(std::span<RGB> out, std::span<const OKLCH> in) {
+    size_t count = std::min(out.size(), in.size());
+    for (size_t i = 0; i < count; i++) {
+        OKLab lab;
+        PolarToOKLab(lab, in[i]);
+        OKLabToRGBInline(out[i], lab);
+    }
+}
+
+void Color::RGBtoLab(std::span<Lab> out, std::span<const RGB> in) {
+    size_t count = std::min(out.size(), in.size());
+    for (size_t i = 0; i < count; i++) RGBToLabInline(out[i], in[i]);
+}
+
+void Color::LabtoRGB(std::span<RGB> out, std::span<const Lab> in) {
+    size_t count = std::min(out.size(), in.size());
+    for (size_t i = 0; i < count; i++) LabToRGBInline(out[i], in[i]);
+}
+
+Color::ANSI Color::RGBtoANSI(const RGB& in, bool fg, Mode mode) {
+    switch (mode) {
+        case Mode::Indexed256:
+            return (fg ? "\033[38;5;" : "\033[48;5;") + std::to_string(RGBto256(in)) + "m";
+        case Mode::Indexed16: {
+            uint8_t index = RGBto16(in);
+            int code = (index < 8 ? 30 + index : 90 + index - 8) + (fg ? 0 : 10);
+            return "\033[" + std::to_string(code) + "m";
+        }
+        case Mode::TrueColor:
+            break;
+    }
     if (fg) {
         return "\033[38;2;" + std::to_string(in.r) + ";" + std::to_string(in.g) + ";" + std::to_string(in.b) + "m";
     } else {
         return "\033[48;2;" + std::to_string(in.r) + ";" + std::to_string(in.g) + ";" + std::to_string(in.b) + "m";
     }
-}
\ No newline at end of file
+}
+
+// -------------------------------------------------------------
+// PALETTE QUANTIZATION
+// -------------------------------------------------------------
+namespace {
+
+    constexpr int LUTBits = 6;                      // Bits per channel the lookup tables are indexed by
+    constexpr int LUTSize = 1 << LUTBits;
+    constexpr uint8_t CubeLevels[6] = {0, 95, 135, 175, 215, 255};
+
+    constexpr Color::RGB ANSIColors[16] = {
+        {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0}, {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+        {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0}, {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255},
+    };
+
+    int Distance(const Color::RGB& a, const Color::RGB& b) {
+        int dr = a.r - b.r, dg = a.g - b.g, db = a.b - b.b;
+        return dr * dr + dg * dg + db * db;
+    }
+
+    /** Nearest of the 6 levels of the xterm color cube. */
+    int NearestCubeLevel(int value) {
+        int best = 0;
+        for (int i = 1; i < 6; i++) {
+            if (std::abs(value - CubeLevels[i]) < std::abs(value - CubeLevels[best])) best = i;
+        }
+        return best;
+    }
+
+    /** Exact nearest 256 palette color: the distance splits per channel, so it is either the cube color
+    nearest in every channel or the nearest of the 24 grays. */
+    uint8_t Nearest256(const Color::RGB& in) {
+        int r = NearestCubeLevel(in.r), g = NearestCubeLevel(in.g), b = NearestCubeLevel(in.b);
+        uint8_t cube = static_cast<uint8_t>(16 + 36 * r + 6 * g + b);
+
+        int average = (in.r + in.g + in.b) / 3;
+        int step = std::clamp((average - 8 + 5) / 10, 0, 23);
+        uint8_t gray = static_cast<uint8_t>(232 + step);
+
+        return Distance(in, Color::PaletteColor(gray)) < Distance(in, Color::PaletteColor(cube)) ? gray : cube;
+    }
+
+    uint8_t Nearest16(const Color::RGB& in) {
+        uint8_t best = 0;
+        for (uint8_t i = 1; i < 16; i++) {
+            if (Distance(in, ANSIColors[i]) < Distance(in, ANSIColors[best])) best = i;
+        }
+        return best;
+    }
+
+    /** Palette index for every color, sampled at the center of each LUTSize^3 bin. */
+    struct QuantizeLUT {
+        uint8_t index[LUTSize * LUTSize * LUTSize];
+
+        explicit QuantizeLUT(uint8_t (*nearest)(const Color::RGB&)) {
+            constexpr int half = 1 << (7 - LUTBits);
+            for (int r = 0; r < LUTSize; r++)
+                for (int g = 0; g < LUTSize; g++)
+                    for (int b = 0; b < LUTSize; b++) {
+                        Color::RGB center = {
+                            static_cast<uint8_t>((r << (8 - LUTBits)) + half),
+                            static_cast<uint8_t>((g << (8 - LUTBits)) + half),
+                            static_cast<uint8_t>((b << (8 - LUTBits)) + half)
+                        };
+                        index[(r * LUTSize + g) * LUTSize + b] = nearest(center);
+                    }
+        }
+
+        uint8_t operator[](const Color::RGB& in) const {
+            constexpr int shift = 8 - LUTBits;
+            return index[((in.r >> shift) * LUTSize + (in.g >> shift)) * LUTSize + (in.b >> shift)];
+        }
+    };
+}
+
+uint8_t Color::RGBto256(const RGB& in) {
+    // Built on first use, so truecolor output never pays for it
+    static const QuantizeLUT lut(Nearest256);
+    return lut[in];
+}
+
+uint8_t Color::RGBto16(const RGB& in) {
+    static const QuantizeLUT lut(Nearest16);
+    return lut[in];
+}
+
+Color::RGB Color::PaletteColor(uint8_t index) {
+    if (index < 16) return ANSIColors[index];
+    if (index >= 232) {
+        uint8_t level = static_cast<uint8_t>(8 + 10 * (index - 232));
+        return {level, level, level};
+    }
+    index -= 16;
+    return {CubeLevels[index / 36], CubeLevels[index / 6 % 6], CubeLevels[index % 6]};
+}
+
+Color::Mode Color::DetectMode(const char* colorterm, const char* term) {
+    std::string_view ct = colorterm ? colorterm : "";
+    std::string_view t = term ? term : "";
+
+    if (ct == "truecolor" || ct == "24bit" || t.find("direct") != std::string_view::npos) return Mode::TrueColor;
+    if (t.find("256color") != std::string_view::npos) return Mode::Indexed256;
+    return Mode::Indexed16;
+}
+
+// -------------------------------------------------------------
+// BATCH CONVERSIONS
+// -------------------------------------------------------------
+namespace {
+
+    /** GCC vector types with W float / int32 lanes. The kernels below are written once against these
+    and instantiated inside functions compiled for a specific instruction set. Every operation
+    mirrors the scalar version step by step, so the results stay bit-identical. */
+    template <size_t W>
+    struct Lanes {
+        typedef float F __attribute__((vector_size(W * sizeof(float))));
+        typedef int32_t I __attribute__((vector_size(W * sizeof(int32_t))));
+        typedef double D __attribute__((vector_size(W * sizeof(double))));
+        typedef int64_t L __attribute__((vector_size(W * sizeof(int64_t))));
+    };
+
+    constexpr int32_t AbsMask = 0x7fffffff;
+    constexpr int64_t AbsMask64 = 0x7fffffffffffffff;
+
+    template <size_t W>
+    [[gnu::always_inline]] inline size_t RGBtoHSLKernel(const Color::HSLPlanes& out, const Color::RGBPlanes& in, size_t count) {
+        typedef typename Lanes<W>::F F;
+        typedef typename Lanes<W>::I I;
+        const F zero = {}, one = zero + 1.0f;
+
+        size_t i = 0;
+        for (; i + W <= count; i += W) {
+            F rf, gf, bf;
+            for (size_t j = 0; j < W; j++) {
+                rf[j] = in.r[i + j];
+                gf[j] = in.g[i + j];
+                bf[j] = in.b[i + j];
+            }
+            rf /= 255.0f;
+            gf /= 255.0f;
+            bf /= 255.0f;
+
+            F max = rf < gf ? gf : rf;
+            max = max < bf ? bf : max;
+            F min = gf < rf ? gf : rf;
+            min = bf < min ? bf : min;
+            F delta = max - min;
+
+            // (g - b) / delta is within [-1, 1], so fmod(x, 6) is x itself
+            F hr = (gf - bf) / delta;
+            hr = hr < zero ? hr + 6.0f : hr;
+            F hg = ((bf - rf) / delta) + 2.0f;
+            F hb = ((rf - gf) / delta) + 4.0f;
+            F hue = max == rf ? hr : (max == gf ? hg : hb);
+            hue /= 6.0f;
+
+            I nonzero = delta != zero;
+            F l = (max + min) / 2.0f;
+            F dist = (F)((I)(2.0f * l - 1.0f) & AbsMask);
+            F h = nonzero ? hue : zero;
+            F s = nonzero ? delta / (one - dist) : zero;
+
+            for (size_t j = 0; j < W; j++) {
+                out.h[i + j] = h[j];
+                out.s[i + j] = s[j];
+                out.l[i + j] = l[j];
+            }
+        }
+        return i;
+    }
+
+    template <size_t W>
+    [[gnu::always_inline]] inline size_t HSLtoRGBKernel(const Color::RGBPlanes& out, const Color::HSLPlanes& in, size_t count) {
+        typedef typename Lanes<W>::F F;
+        typedef typename Lanes<W>::I I;
+        typedef typename Lanes<W>::D D;
+        typedef typename Lanes<W>::L L;
+        const F zero = {};
+
+        size_t i = 0;
+        for (; i + W <= count; i += W) {
+            F hin, s, l;
+            for (size_t j = 0; j < W; j++) {
+                hin[j] = in.h[i + j];
+                s[j] = in.s[i + j];
+                l[j] = in.l[i + j];
+            }
+
+            F h = hin * 6.0f;
+            F c = (1.0f - (F)((I)(2.0f * l - 1.0f) & AbsMask)) * s;
+
+            // fmod(h, 2): h - 2 * trunc(h / 2) is exact for the sector range.
+            // The scalar version goes through the double overload of fmod, so x is computed in double too
+            F sector = __builtin_convertvector(__builtin_convertvector(h / 2.0f, I), F);
+            D hmod = __builtin_convertvector(h - 2.0f * sector, D);
+            D dist = (D)((L)(hmod - 1.0) & AbsMask64);
+            F x = __builtin_convertvector(__builtin_convertvector(c, D) * (1.0 - dist), F);
+            F m = l - c / 2.0f;
+
+            I s1 = h < 1.0f, s2 = h < 2.0f, s3 = h < 3.0f, s4 = h < 4.0f, s5 = h < 5.0f;
+            F rf = s1 ? c : s2 ? x : s4 ? zero : s5 ? x : c;
+            F gf = s1 ? x : s3 ? c : s4 ? x : zero;
+            F bf = s2 ? zero : s3 ? x : s5 ? c : x;
+
+            I r = __builtin_convertvector((rf + m) * 255.0f + 0.5f, I);
+            I g = __builtin_convertvector((gf + m) * 255.0f + 0.5f, I);
+            I b = __builtin_convertvector((bf + m) * 255.0f + 0.5f, I);
+
+            for (size_t j = 0; j < W; j++) {
+                out.r[i + j] = static_cast<uint8_t>(r[j]);
+                out.g[i + j] = static_cast<uint8_t>(g[j]);
+                out.b[i + j] = static_cast<uint8_t>(b[j]);
+            }
+        }
+        return i;
+    }
+
+    template <size_t W>
+    [[gnu::always_inline]] inline size_t RGBtoCMYKKernel(const Color::CMYKPlanes& out, const Color::RGBPlanes& in, size_t count) {
+        typedef typename Lanes<W>::F F;
+        typedef typename Lanes<W>::I I;
+        const F zero = {}, one = zero + 1.0f;
+
+        size_t i = 0;
+        for (; i + W <= count; i += W) {
+            F rf, gf, bf;
+            for (size_t j = 0; j < W; j++) {
+                rf[j] = in.r[i + j];
+                gf[j] = in.g[i + j];
+                bf[j] = in.b[i + j];
+            }
+            rf /= 255.0f;
+            gf /= 255.0f;
+            bf /= 255.0f;
+
+            F max = rf < gf ? gf : rf;
+            max = max < bf ? bf : max;
+            F k = 1.0f - max;
+            F d = 1.0f - k;
+            I black = k == one;
+
+            F c = black ? zero : (1.0f - rf - k) / d;
+            F m = black ? zero : (1.0f - gf - k) / d;
+            F y = black ? zero : (1.0f - bf - k) / d;
+
+            for (size_t j = 0; j < W; j++) {
+                out.c[i + j] = c[j];
+                out.m[i + j] = m[j];
+                out.y[i + j] = y[j];
+                out.k[i + j] = k[j];
+            }
+        }
+        return i;
+    }
+
+    template <size_t W>
+    [[gnu::always_inline]] inline size_t CMYKtoRGBKernel(const Color::RGBPlanes& out, const Color::CMYKPlanes& in, size_t count) {
+        typedef typename Lanes<W>::F F;
+        typedef typename Lanes<W>::I I;
+
+        size_t i = 0;
+        for (; i + W <= count; i += W) {
+            F c, m, y, k;
+            for (size_t j = 0; j < W; j++) {
+                c[j] = in.c[i + j];
+                m[j] = in.m[i + j];
+                y[j] = in.y[i + j];
+                k[j] = in.k[i + j];
+            }
+
+            F kf = 1.0f - k;
+            I r = __builtin_convertvector(255.0f * (1.0f - c) * kf, I);
+            I g = __builtin_convertvector(255.0f * (1.0f - m) * kf, I);
+            I b = __builtin_convertvector(255.0f * (1.0f - y) * kf, I);
+
+            for (size_t j = 0; j < W; j++) {
+                out.r[i + j] = static_cast<uint8_t>(r[j]);
+                out.g[i + j] = static_cast<uint8_t>(g[j]);
+                out.b[i + j] = static_cast<uint8_t>(b[j]);
+            }
+        }
+        return i;
+    }
+
+    enum class Backend { Scalar, SSE4, AVX2 };
+
+    Backend DetectBackend() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return Backend::AVX2;
+        if (__builtin_cpu_supports("sse4.1")) return Backend::SSE4;
+#endif
+        return Backend::Scalar;
+    }
+
+    const Backend backend = DetectBackend();
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CLID_BATCH_X86
+
+    __attribute__((target("avx2"))) size_t RGBtoHSL_AVX2(const Color::HSLPlanes& out, const Color::RGBPlanes& in, size_t count) { return RGBtoHSLKernel<8>(out, in, count); }
+    __attribute__((target("avx2"))) size_t HSLtoRGB_AVX2(const Color::RGBPlanes& out, const Color::HSLPlanes& in, size_t count) { return HSLtoRGBKernel<8>(out, in, count); }
+    __attribute__((target("avx2"))) size_t RGBtoCMYK_AVX2(const Color::CMYKPlanes& out, const Color::RGBPlanes& in, size_t count) { return RGBtoCMYKKernel<8>(out, in, count); }
+    __attribute__((target("avx2"))) size_t CMYKtoRGB_AVX2(const Color::RGBPlanes& out, const Color::CMYKPlanes& in, size_t count) { return CMYKtoRGBKernel<8>(out, in, count); }
+
+    __attribute__((target("sse4.1"))) size_t RGBtoHSL_SSE4(const Color::HSLPlanes& out, const Color::RGBPlanes& in, size_t count) { return RGBtoHSLKernel<4>(out, in, count); }
+    __attribute__((target("sse4.1"))) size_t HSLtoRGB_SSE4(const Color::RGBPlanes& out, const Color::HSLPlanes& in, size_t count) { return HSLtoRGBKernel<4>(out, in, count); }
+    __attribute__((target("sse4.1"))) size_t RGBtoCMYK_SSE4(const Color::CMYKPlanes& out, const Color::RGBPlanes& in, size_t count) { return RGBtoCMYKKernel<4>(out, in, count); }
+    __attribute__((target("sse4.1"))) size_t CMYKtoRGB_SSE4(const Color::RGBPlanes& out, const Color::CMYKPlanes& in, size_t count) { return CMYKtoRGBKernel<4>(out, in, count); }
+#endif
+
+    constexpr size_t TileSize = 256; // Interleaved input is converted through planar tiles of this size
+}
+
+const char* Color::BatchBackend() {
+    switch (backend) {
+        case Backend::AVX2: return "avx2";
+        case Backend::SSE4: return "sse4.1";
+        default: return "scalar";
+    }
+}
+
+void Color::RGBtoHSL(const HSLPlanes& out, const RGBPlanes& in, size_t count) {
+    size_t i = 0;
+#ifdef CLID_BATCH_X86
+    if (backend == Backend::AVX2) i = RGBtoHSL_AVX2(out, in, count);
+    else if (backend == Backend::SSE4) i = RGBtoHSL_SSE4(out, in, count);
+#endif
+    for (; i < count; i++) {
+        HSL hsl;
+        RGBtoHSL(hsl, {in.r[i], in.g[i], in.b[i]});
+        out.h[i] = hsl.h;
+        out.s[i] = hsl.s;
+        out.l[i] = hsl.l;
+    }
+}
+
+void Color::HSLtoRGB(const RGBPlanes& out, const HSLPlanes& in, size_t count) {
+    size_t i = 0;
+#ifdef CLID_BATCH_X86
+    if (backend == Backend::AVX2) i = HSLtoRGB_AVX2(out, in, count);
+    else if (backend == Backend::SSE4) i = HSLtoRGB_SSE4(out, in, count);
+#endif
+    for (; i < count; i++) {
+        RGB rgb;
+        HSLtoRGB(rgb, {in.h[i], in.s[i], in.l[i]});
+        out.r[i] = rgb.r;
+        out.g[i] = rgb.g;
+        out.b[i] = rgb.b;
+    }
+}
+
+void Color::RGBtoCMYK(const CMYKPlanes& out, const RGBPlanes& in, size_t count) {
+    size_t i = 0;
+#ifdef CLID_BATCH_X86
+    if (backend == Backend::AVX2) i = RGBtoCMYK_AVX2(out, in, count);
+    else if (backend == Backend::SSE4) i = RGBtoCMYK_SSE4(out, in, count);
+#endif
+    for (; i < count; i++) {
+        CMYK cmyk;
+        RGBtoCMYK(cmyk, {in.r[i], in.g[i], in.b[i]});
+        out.c[i] = cmyk.c;
+        out.m[i] = cmyk.m;
+        out.y[i] = cmyk.y;
+        out.k[i] = cmyk.k;
+    }
+}
+
+void Color::CMYKtoRGB(const RGBPlanes& out, const CMYKPlanes& in, size_t count) {
+    size_t i = 0;
+#ifdef CLID_BATCH_X86
+    if (backend == Backend::AVX2) i = CMYKtoRGB_AVX2(out, in, count);
+    else if (backend == Backend::SSE4) i = CMYKtoRGB_SSE4(out, in, count);
+#endif
+    for (; i < count; i++) {
+        RGB rgb;
+        CMYKtoRGB(rgb, {in.c[i], in.m[i], in.y[i], in.k[i]});
+        out.r[i] = rgb.r;
+        out.g[i] = rgb.g;
+        out.b[i] = rgb.b;
+    }
+}
+
+void Color::RGBtoHSL(std::span<HSL> out, std::span<const RGB> in) {
+    uint8_t r[TileSize], g[TileSize], b[TileSize];
+    float h[TileSize], s[TileSize], l[TileSize];
+
+    size_t count = std::min(out.size(), in.size());
+    for (size_t base = 0; base < count; base += TileSize) {
+        size_t n = std::min(TileSize, count - base);
+        for (size_t i = 0; i < n; i++) {
+            r[i] = in[base + i].r;
+            g[i] = in[base + i].g;
+            b[i] = in[base + i].b;
+        }
+        RGBtoHSL(HSLPlanes{h, s, l}, RGBPlanes{r, g, b}, n);
+        for (size_t i = 0; i < n; i++) out[base + i] = {h[i], s[i], l[i]};
+    }
+}
+
+void Color::HSLtoRGB(std::span<RGB> out, std::span<const HSL> in) {
+    uint8_t r[TileSize], g[TileSize], b[TileSize];
+    float h[TileSize], s[TileSize], l[TileSize];
+
+    size_t count = std::min(out.size(), in.size());
+    for (size_t base = 0; base < count; base += TileSize) {
+        size_t n = std::min(TileSize, count - base);
+        for (size_t i = 0; i < n; i++) {
+            h[i] = in[base + i].h;
+            s[i] = in[base + i].s;
+            l[i] = in[base + i].l;
+        }
+        HSLtoRGB(RGBPlanes{r, g, b}, HSLPlanes{h, s, l}, n);
+        for (size_t i = 0; i < n; i++) out[base + i] = {r[i], g[i], b[i]};
+    }
+}
+
+void Color::RGBtoCMYK(std::span<CMYK> out, std::span<const RGB> in) {
+    uint8_t r[TileSize], g[TileSize], b[TileSize];
+    float c[TileSize], m[TileSize], y[TileSize], k[TileSize];
+
+    size_t count = std::min(out.size(), in.size());
+    for (size_t base = 0; base < count; base += TileSize) {
+        size_t n = std::min(TileSize, count - base);
+        for (size_t i = 0; i < n; i++) {
+            r[i] = in[base + i].r;
+            g[i] = in[base + i].g;
+            b[i] = in[base + i].b;
+        }
+        RGBtoCMYK(CMYKPlanes{c, m, y, k}, RGBPlanes{r, g, b}, n);
+        for (size_t i = 0; i < n; i++) out[base + i] = {c[i], m[i], y[i], k[i]};
+    }
+}
+
+void Color::CMYKtoRGB(std::span<RGB> out, std::span<const CMYK> in) {
+    uint8_t r[TileSize], g[TileSize], b[TileSize];
+    float c[TileSize], m[TileSize], y[TileSize], k[TileSize];
+
+    size_t count = std::min(out.size(), in.size());
+    for (size_t base = 0; base < count; base += TileSize) {
+        size_t n = std::min(TileSize, count - base);
+        for (size_t i = 0; i < n; i++) {
+            c[i] = in[base + i].c;
+            m[i] = in[base + i].m;
+            y[i] = in[base + i].y;
+            k[i] = in[base + i].k;
+        }
+        CMYKtoRGB(RGBPlanes{r, g, b}, CMYKPlanes{c, m, y, k}, n);
+        for (size_t i = 0; i < n; i++) out[base + i] = {r[i], g[i], b[i]};
+    }
+}
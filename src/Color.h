@@ -2,13 +2,22 @@
 
 #include <cstdint>
 #include <string>
+#include <span>
+#include <string_view>
 
 namespace Color {
 
+    enum class Format { RGB, HEX, CMYK, HSL, OKLAB, OKLCH, LAB };
+
+    /** How colors are sent to the terminal: 24-bit, the xterm 256 color palette or the 16 ANSI colors. */
+    enum class Mode { TrueColor, Indexed256, Indexed16 };
+
     struct RGB {
         uint8_t r;
         uint8_t g;
         uint8_t b;
+
+        bool operator==(const RGB&) const = default;
     };
 
     struct CMYK {
@@ -24,6 +33,42 @@ namespace Color {
         float l;
     };
 
+    /** Perceptual color space, euclidean distances roughly match how different two colors look. L is 0-1. */
+    struct OKLab {
+        float L;
+        float a;
+        float b;
+    };
+
+    /** OKLab in polar form: lightness, chroma and hue in degrees (0-360). */
+    struct OKLCH {
+        float L;
+        float C;
+        float h;
+    };
+
+    /** CIE L*a*b* relative to the D65 white point. L is 0-100. */
+    struct Lab {
+        float L;
+        float a;
+        float b;
+    };
+
+    /** HSL in 16 bit fixed point: h in 1/65536 turns, s and l in 1/65535. */
+    struct HSL16 {
+        uint16_t h;
+        uint16_t s;
+        uint16_t l;
+    };
+
+    /** CMYK in 16 bit fixed point, every channel in 1/65535. */
+    struct CMYK16 {
+        uint16_t c;
+        uint16_t m;
+        uint16_t y;
+        uint16_t k;
+    };
+
     typedef std::string HEX;
     typedef std::string ANSI;
 
@@ -33,6 +78,97 @@ namespace Color {
     bool HEXtoRGB(RGB& out, const HEX& in);
     void RGBtoCMYK(CMYK& out, const RGB& in);
     void CMYKtoRGB(RGB& out, const CMYK& in);
+    void RGBtoOKLab(OKLab& out, const RGB& in);
+    void OKLabtoRGB(RGB& out, const OKLab& in);
+    void OKLabtoOKLCH(OKLCH& out, const OKLab& in);
+    void OKLCHtoOKLab(OKLab& out, const OKLCH& in);
+    void RGBtoOKLCH(OKLCH& out, const RGB& in);
+    void OKLCHtoRGB(RGB& out, const OKLCH& in);
+    void RGBtoLab(Lab& out, const RGB& in);
+    void LabtoRGB(RGB& out, const Lab& in);
+
+    /** Integer versions of the HSL and CMYK conversions. Every step rounds to nearest, so every RGB color
+    survives a round trip through HSL16 or CMYK16 unchanged (checked for all colors by `make validate`). */
+    void RGBtoHSL16(HSL16& out, const RGB& in);
+    void HSL16toRGB(RGB& out, const HSL16& in);
+    void RGBtoCMYK16(CMYK16& out, const RGB& in);
+    void CMYK16toRGB(RGB& out, const CMYK16& in);
+
+    /** Largest chroma an OKLCH color of this lightness and hue can have without leaving sRGB. */
+    float MaxChroma(float L, float h);
+
+    /** sRGB byte to linear light, through a 256 entry table. */
+    float SRGBtoLinear(uint8_t in);
+
+    /** Linear light to the nearest sRGB byte. Values outside [0, 1] are clamped. */
+    uint8_t LinearToSRGB(float in);
+
+    /** Cube root from a bit level estimate refined with two Halley steps, within 1e-6 relative error. */
+    float FastCbrt(float x);
+
+    /** Encode a color as null terminated "#RRGGBB" into out. Returns the number of chars written (7). */
+    size_t EncodeHEX(char (&out)[8], const RGB& in);
+
+    /** Parse "RGB", "RRGGBB" or "RRGGBBAA" with an optional '#' or "0x" prefix, without allocating or throwing.
+    alpha receives the alpha channel (255 if the input has none) when it is not null. */
+    bool DecodeHEX(RGB& out, std::string_view in, uint8_t* alpha = nullptr);
+
+    ANSI RGBtoANSI(const RGB& in, bool fg = true, Mode mode = Mode::TrueColor);
+
+    /** Index of the nearest xterm 256 palette color (16-255, the first 16 depend on the terminal theme). */
+    uint8_t RGBto256(const RGB& in);
+
+    /** Index (0-15) of the nearest of the 16 ANSI colors, with xterm's default values. */
+    uint8_t RGBto16(const RGB& in);
+
+    /** The color a palette index stands for. */
+    RGB PaletteColor(uint8_t index);
+
+    /** Pick a mode from the COLORTERM and TERM environment variables (either may be null). */
+    Mode DetectMode(const char* colorterm, const char* term);
+
+    /** Planar (SoA) views used by the batch conversions. Every plane holds `count` elements. */
+    struct RGBPlanes {
+        uint8_t* r;
+        uint8_t* g;
+        uint8_t* b;
+    };
+
+    struct HSLPlanes {
+        float* h;
+        float* s;
+        float* l;
+    };
+
+    struct CMYKPlanes {
+        float* c;
+        float* m;
+        float* y;
+        float* k;
+    };
+
+    /** Batch conversions over whole arrays, using AVX2 or SSE4.1 kernels when the cpu supports them.
+    Results are bit-identical to the single color functions as long as the float inputs
+    are in [0, 1]. Interleaved spans convert min(out.size(), in.size()) elements. */
+    void RGBtoHSL(std::span<HSL> out, std::span<const RGB> in);
+    void HSLtoRGB(std::span<RGB> out, std::span<const HSL> in);
+    void RGBtoCMYK(std::span<CMYK> out, std::span<const RGB> in);
+    void CMYKtoRGB(std::span<RGB> out, std::span<const CMYK> in);
+
+    /** Batch versions of the perceptual conversions, with the same results as the single color functions.
+    They run the shared table lookups, matrices and cube roots in one loop without calls per color. */
+    void RGBtoOKLab(std::span<OKLab> out, std::span<const RGB> in);
+    void OKLabtoRGB(std::span<RGB> out, std::span<const OKLab> in);
+    void RGBtoOKLCH(std::span<OKLCH> out, std::span<const RGB> in);
+    void OKLCHtoRGB(std::span<RGB> out, std::span<const OKLCH> in);
+    void RGBtoLab(std::span<Lab> out, std::span<const RGB> in);
+    void LabtoRGB(std::span<RGB> out, std::span<const Lab> in);
+
+    void RGBtoHSL(const HSLPlanes& out, const RGBPlanes& in, size_t count);
+    void HSLtoRGB(const RGBPlanes& out, const HSLPlanes& in, size_t count);
+    void RGBtoCMYK(const CMYKPlanes& out, const RGBPlanes& in, size_t count);
+    void CMYKtoRGB(const RGBPlanes& out, const CMYKPlanes& in, size_t count);
 
-    ANSI RGBtoANSI(const RGB& in, bool fg = true);
+    /** Name of the kernel set picked for the batch conversions ("avx2", "sse4.1" or "scalar"). */
+    const char* BatchBackend();
 }
\ No newline at end of file
@@ -0,0 +1,408 @@
+#include "Contrast.h"
+#include "Palette.h"
+#include "Parallel.h"
+#include "Utility.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+using namespace Contrast;
+
+namespace {
+
+    constexpr size_t RowBand = 128;         // Rows of the pair matrix computed before they are written out
+    constexpr size_t RowGroup = 16;         // Rows of a tile
+    constexpr size_t TileWidth = 512;       // Columns of a tile, their planes stay in cache while the rows run over them
+    constexpr size_t FlushSize = 1 << 20;   // Output is written once it grows past this
+    constexpr double Pow25To7 = 6103515625.0;
+    constexpr double Pi = 3.14159265358979323846;
+
+    double Radians(double degrees) { return degrees * (Pi / 180.0); }
+
+    /** sqrt(C^7 / (C^7 + 25^7)), the chroma weight that appears twice in CIEDE2000. */
+    double ChromaWeightExact(double C) {
+        double c7 = std::pow(C, 7.0);
+        return std::sqrt(c7 / (c7 + Pow25To7));
+    }
+
+    /** Hue angle in degrees (0-360) of a', b; 0 for a gray. */
+    double HueAngleExact(double a, double b) {
+        if (a == 0.0 && b == 0.0) return 0.0;
+        double h = std::atan2(b, a) * (180.0 / Pi);
+        return h < 0.0 ? h + 360.0 : h;
+    }
+
+    /** The pair kernels work on W floats at a time through GCC vector extensions, like the batch conversions.
+    sqrt, atan2, sin and exp are polynomial or Newton approximations that only use plain vector arithmetic. */
+    template <size_t W>
+    struct Lanes {
+        typedef float F __attribute__((vector_size(W * sizeof(float))));
+        typedef int32_t I __attribute__((vector_size(W * sizeof(int32_t))));
+    };
+
+    constexpr int32_t AbsMask = 0x7fffffff;
+    constexpr float PiF = 3.14159265f;
+    constexpr float HalfPiF = 1.57079633f;
+
+    // The helpers pass vectors by reference, vector arguments and results by value would change the ABI for AVX
+    /** Square root of x >= 0 from the bit level reciprocal square root estimate and three Newton steps. */
+    template <typename F, typename I>
+    [[gnu::always_inline]] inline void Sqrt(F& out, const F& x) {
+        F y = (F)(0x5f3759df - ((I)x >> 1));
+        F half = x * 0.5f;
+        for (int step = 0; step < 3; step++) y = y * (1.5f - half * y * y);
+        out = x * y;
+    }
+
+    /** sin(x) for x in [-pi/2, pi/2], Taylor series up to x^11 (error below 6e-8). */
+    template <typename F>
+    [[gnu::always_inline]] inline void Sin(F& out, const F& x) {
+        const F zero = {};
+        F z = x * x;
+        F p = zero - 2.50521084e-8f;
+        p = p * z + 2.75573192e-6f;
+        p = p * z - 1.98412698e-4f;
+        p = p * z + 8.33333333e-3f;
+        p = p * z - 1.66666667e-1f;
+        out = x + x * z * p;
+    }
+
+    /** exp(x) for x <= 0: 2^n by building the exponent bits and 2^f, |f| <= 0.5, by the Taylor series of e^(f ln 2). */
+    template <typename F, typename I>
+    [[gnu::always_inline]] inline void Exp(F& out, const F& x) {
+        const F zero = {};
+        F t = x * 1.44269504f;
+        t = t < -126.0f ? zero - 126.0f : t;
+        I n = -__builtin_convertvector(0.5f - t, I);
+        F f = (t - __builtin_convertvector(n, F)) * 0.693147181f;
+        F p = zero + 1.98412698e-4f;
+        p = p * f + 1.38888889e-3f;
+        p = p * f + 8.33333333e-3f;
+        p = p * f + 4.16666667e-2f;
+        p = p * f + 1.66666667e-1f;
+        p = p * f + 0.5f;
+        p = p * f + 1.0f;
+        p = p * f + 1.0f;
+        out = p * (F)((n + 127) << 23);
+    }
+
+    /** atan2(y, x) in degrees (0-360), 0 for x = y = 0. The octant reduction and polynomial follow Cephes atanf. */
+    template <typename F, typename I>
+    [[gnu::always_inline]] inline void HueAngle(F& out, const F& y, const F& x) {
+        const F zero = {};
+        F ax = (F)((I)x & AbsMask), ay = (F)((I)y & AbsMask);
+        F hi = ax < ay ? ay : ax, lo = ax < ay ? ax : ay;
+        F t = lo / (hi > zero ? hi : zero + 1.0f);
+
+        I upper = t > 0.414213562f;
+        F base = upper ? zero + PiF / 4.0f : zero;
+        t = upper ? (t - 1.0f) / (t + 1.0f) : t;
+        F z = t * t;
+        F a = base + ((((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z
+            - 3.33329491539e-1f) * z * t + t);
+
+        a = ay > ax ? HalfPiF - a : a;
+        a = x < zero ? PiF - a : a;
+        a = y < zero ? -a : a;
+        F degrees = a * (180.0f / PiF);
+        out = degrees < zero ? degrees + 360.0f : degrees;
+    }
+
+    template <typename F, typename I>
+    [[gnu::always_inline]] inline void ChromaWeight(F& out, const F& C) {
+        F c2 = C * C;
+        F c7 = c2 * c2 * c2 * C;
+        Sqrt<F, I>(out, c7 / (c7 + static_cast<float>(Pow25To7)));
+    }
+
+    /** Ratio and CIEDE2000 of color i against W columns at a time, the same steps as DeltaE2000 in float.
+    Pairs whose hues are within SeamWidth of opposite get NaN: the mean hue flips by 180 degrees there, so the
+    approximated hues could land on the other side. Row computes those in double. */
+    constexpr float SeamWidth = 1e-2f;
+
+    template <size_t W>
+    [[gnu::always_inline]] inline size_t RowKernel(float* ratio, float* deltaE, const Planes& planes, size_t i,
+                                                   size_t first, size_t last) {
+        typedef typename Lanes<W>::F F;
+        typedef typename Lanes<W>::I I;
+        const F zero = {};
+        const F Y1 = zero + planes.luminance[i], L1 = zero + planes.L[i], a1 = zero + planes.a[i],
+            b1 = zero + planes.b[i], C1 = zero + planes.C[i];
+
+        size_t j = first;
+        for (; j + W <= last; j += W) {
+            F Y2, L2, a2, b2, C2;
+            for (size_t k = 0; k < W; k++) {
+                Y2[k] = planes.luminance[j + k];
+                L2[k] = planes.L[j + k];
+                a2[k] = planes.a[j + k];
+                b2[k] = planes.b[j + k];
+                C2[k] = planes.C[j + k];
+            }
+
+            // WCAG contrast, the same operations as Ratio
+            F hiY = Y1 > Y2 ? Y1 : Y2, loY = Y1 > Y2 ? Y2 : Y1;
+            F r = (hiY + 0.05f) / (loY + 0.05f);
+
+            // a' stretches a of low chroma colors, C' and h' follow from it
+            F weight, C1p, C2p, h1p, h2p;
+            ChromaWeight<F, I>(weight, (C1 + C2) * 0.5f);
+            F scale = 1.0f + 0.5f * (1.0f - weight);
+            F a1p = a1 * scale, a2p = a2 * scale;
+            Sqrt<F, I>(C1p, a1p * a1p + b1 * b1);
+            Sqrt<F, I>(C2p, a2p * a2p + b2 * b2);
+            HueAngle<F, I>(h1p, b1, a1p);
+            HueAngle<F, I>(h2p, b2, a2p);
+            I chromatic = C1p * C2p > zero;
+
+            F dh = h2p - h1p;
+            dh = dh > 180.0f ? dh - 360.0f : dh;
+            dh = dh < -180.0f ? dh + 360.0f : dh;
+            dh = chromatic ? dh : zero;
+            F dL = L2 - L1, dC = C2p - C1p;
+            F rootC, sinHalf;
+            Sqrt<F, I>(rootC, C1p * C2p);
+            Sin(sinHalf, dh * (PiF / 360.0f));
+            F dH = 2.0f * rootC * sinHalf;
+
+            F hsum = h1p + h2p, hdiff = (F)((I)(h1p - h2p) & AbsMask);
+            F hbar = hdiff <= 180.0f ? hsum * 0.5f : (hsum < 360.0f ? (hsum + 360.0f) * 0.5f : (hsum - 360.0f) * 0.5f);
+            hbar = chromatic ? hbar : hsum;
+            I seam = chromatic & ((F)((I)(hdiff - 180.0f) & AbsMask) < SeamWidth);
+
+            // cos(n * hbar + offset) from cos and sin of hbar through the multiple angle identities.
+            // x = hbar - pi is in [-pi, pi), it is folded onto [-pi/2, pi/2] for the sine
+            F x = hbar * (PiF / 180.0f) - PiF, s1, c1;
+            F folded = x > HalfPiF ? PiF - x : (x < -HalfPiF ? -PiF - x : x);
+            Sin(s1, folded);
+            Sin(c1, HalfPiF - (F)((I)x & AbsMask));
+            s1 = -s1;
+            c1 = -c1;
+            F c2 = c1 * c1 - s1 * s1, s2 = 2.0f * c1 * s1;
+            F c3 = c1 * c2 - s1 * s2, s3 = s1 * c2 + c1 * s2;
+            F c4 = c2 * c2 - s2 * s2, s4 = 2.0f * c2 * s2;
+            F T = 1.0f - 0.17f * (c1 * 0.866025404f + s1 * 0.5f) + 0.24f * c2
+                + 0.32f * (c3 * 0.994521895f - s3 * 0.104528463f) - 0.20f * (c4 * 0.453990500f + s4 * 0.891006524f);
+
+            F hc = (hbar - 275.0f) * (1.0f / 25.0f), dTheta, sinTheta, RC;
+            Exp<F, I>(dTheta, -hc * hc);
+            dTheta *= 30.0f;
+            F Cbarp = (C1p + C2p) * 0.5f;
+            Sin(sinTheta, dTheta * (PiF / 90.0f));
+            ChromaWeight<F, I>(RC, Cbarp);
+            F RT = -sinTheta * 2.0f * RC;
+
+            F l50 = (L1 + L2) * 0.5f - 50.0f, rootL;
+            l50 *= l50;
+            Sqrt<F, I>(rootL, 20.0f + l50);
+            F SL = 1.0f + 0.015f * l50 / rootL;
+            F SC = 1.0f + 0.045f * Cbarp;
+            F SH = 1.0f + 0.015f * Cbarp * T;
+
+            F tL = dL / SL, tC = dC / SC, tH = dH / SH, e;
+            F sum = tL * tL + tC * tC + tH * tH + RT * tC * tH;
+            Sqrt<F, I>(e, sum > zero ? sum : zero);
+            e = seam ? zero + NAN : e;
+
+            for (size_t k = 0; k < W; k++) {
+                ratio[j - first + k] = r[k];
+                deltaE[j - first + k] = e[k];
+            }
+        }
+        return j - first;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CLID_CONTRAST_X86
+    __attribute__((target("avx2"))) size_t Row_AVX2(float* ratio, float* deltaE, const Planes& planes, size_t i, size_t first, size_t last) { return RowKernel<8>(ratio, deltaE, planes, i, first, last); }
+    __attribute__((target("sse4.1"))) size_t Row_SSE4(float* ratio, float* deltaE, const Planes& planes, size_t i, size_t first, size_t last) { return RowKernel<4>(ratio, deltaE, planes, i, first, last); }
+#endif
+
+    enum class Kernel { Scalar, SSE4, AVX2 };
+
+    /** Use the instruction set the batch conversions picked. */
+    Kernel PickKernel() {
+        std::string_view backend = Color::BatchBackend();
+        if (backend == "avx2") return Kernel::AVX2;
+        if (backend == "sse4.1") return Kernel::SSE4;
+        return Kernel::Scalar;
+    }
+
+    float PairDeltaE(const Planes& planes, size_t i, size_t j) {
+        return DeltaE2000({planes.L[i], planes.a[i], planes.b[i]}, {planes.L[j], planes.a[j], planes.b[j]});
+    }
+
+    void AppendNumber(std::string& out, float value) {
+        char buffer[32];
+        auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, 2);
+        out.append(buffer, ec == std::errc() ? end : buffer);
+    }
+}
+
+float Contrast::Luminance(const Color::RGB& in) {
+    return 0.2126f * Color::SRGBtoLinear(in.r) + 0.7152f * Color::SRGBtoLinear(in.g)
+        + 0.0722f * Color::SRGBtoLinear(in.b);
+}
+
+float Contrast::DeltaE2000(const Color::Lab& x, const Color::Lab& y) {
+    double L1 = x.L, a1 = x.a, b1 = x.b;
+    double L2 = y.L, a2 = y.a, b2 = y.b;
+
+    double G = 0.5 * (1.0 - ChromaWeightExact((std::hypot(a1, b1) + std::hypot(a2, b2)) / 2.0));
+    double a1p = (1.0 + G) * a1, a2p = (1.0 + G) * a2;
+    double C1p = std::hypot(a1p, b1), C2p = std::hypot(a2p, b2);
+    double h1p = HueAngleExact(a1p, b1), h2p = HueAngleExact(a2p, b2);
+    bool chromatic = C1p * C2p != 0.0;
+
+    double dh = 0.0;
+    if (chromatic) {
+        dh = h2p - h1p;
+        if (dh > 180.0) dh -= 360.0;
+        else if (dh < -180.0) dh += 360.0;
+    }
+    double dL = L2 - L1, dC = C2p - C1p;
+    double dH = 2.0 * std::sqrt(C1p * C2p) * std::sin(Radians(dh / 2.0));
+
+    double hbar = h1p + h2p;
+    if (chromatic) {
+        if (std::fabs(h1p - h2p) <= 180.0) hbar /= 2.0;
+        else hbar = hbar < 360.0 ? (hbar + 360.0) / 2.0 : (hbar - 360.0) / 2.0;
+    }
+
+    double T = 1.0 - 0.17 * std::cos(Radians(hbar - 30.0)) + 0.24 * std::cos(Radians(2.0 * hbar))
+        + 0.32 * std::cos(Radians(3.0 * hbar + 6.0)) - 0.20 * std::cos(Radians(4.0 * hbar - 63.0));
+    double dTheta = 30.0 * std::exp(-std::pow((hbar - 275.0) / 25.0, 2.0));
+    double Cbarp = (C1p + C2p) / 2.0;
+    double RT = -std::sin(Radians(2.0 * dTheta)) * 2.0 * ChromaWeightExact(Cbarp);
+
+    double l50 = std::pow((L1 + L2) / 2.0 - 50.0, 2.0);
+    double SL = 1.0 + 0.015 * l50 / std::sqrt(20.0 + l50);
+    double SC = 1.0 + 0.045 * Cbarp;
+    double SH = 1.0 + 0.015 * Cbarp * T;
+
+    double tL = dL / SL, tC = dC / SC, tH = dH / SH;
+    return static_cast<float>(std::sqrt(tL * tL + tC * tC + tH * tH + RT * tC * tH));
+}
+
+void Contrast::Prepare(Planes& out, std::span<const Color::RGB> colors) {
+    std::vector<Color::Lab> lab(colors.size());
+    Color::RGBtoLab(lab, colors);
+
+    out.luminance.resize(colors.size());
+    out.L.resize(colors.size());
+    out.a.resize(colors.size());
+    out.b.resize(colors.size());
+    out.C.resize(colors.size());
+    for (size_t i = 0; i < colors.size(); i++) {
+        out.luminance[i] = Luminance(colors[i]);
+        out.L[i] = lab[i].L;
+        out.a[i] = lab[i].a;
+        out.b[i] = lab[i].b;
+        out.C[i] = std::sqrt(lab[i].a * lab[i].a + lab[i].b * lab[i].b);
+    }
+}
+
+void Contrast::Row(float* ratio, float* deltaE, const Planes& planes, size_t i, size_t first, size_t last) {
+    static const Kernel kernel = PickKernel();
+
+    size_t done = 0;
+#ifdef CLID_CONTRAST_X86
+    if (kernel == Kernel::AVX2) done = Row_AVX2(ratio, deltaE, planes, i, first, last);
+    else if (kernel == Kernel::SSE4) done = Row_SSE4(ratio, deltaE, planes, i, first, last);
+#endif
+    for (size_t k = 0; k < done; k++) {
+        if (std::isnan(deltaE[k])) deltaE[k] = PairDeltaE(planes, i, first + k);
+    }
+    for (size_t j = first + done; j < last; j++) {
+        ratio[j - first] = Ratio(planes.luminance[i], planes.luminance[j]);
+        deltaE[j - first] = PairDeltaE(planes, i, j);
+    }
+}
+
+bool Contrast::Run(const std::string& palettePath, const Options& options, const Template::Program& output) {
+    std::vector<Palette::Entry> entries;
+    if (!Palette::Read(palettePath, entries)) {
+        std::cerr << "Could not read '" << palettePath << "'!\n";
+        return false;
+    }
+
+    const size_t count = entries.size();
+    std::vector<Color::RGB> colors(count);
+    for (size_t i = 0; i < count; i++) colors[i] = entries[i].rgb;
+    Planes planes;
+    Prepare(planes, colors);
+
+    // Every color is formatted once as "color\tname\t", the pair lines are put together from these
+    std::vector<std::string> labels(count);
+    for (size_t i = 0; i < count; i++) {
+        labels[i].resize(output.maxSize);
+        labels[i].resize(Template::Format(labels[i].data(), output, colors[i]));
+        labels[i] += '\t';
+        labels[i] += entries[i].name;
+        labels[i] += '\t';
+    }
+
+    // Tiles of a band write their pairs to their own text; rowEnds[tile * RowBand + row] is where each row ends
+    std::vector<std::string> tileText;
+    std::vector<size_t> rowEnds;
+    std::string out;
+
+    for (size_t top = 0; top + 1 < count; top += RowBand) {
+        const size_t bottom = std::min(top + RowBand, count);
+        const size_t left = top + 1;                // Only pairs right of the diagonal
+        const size_t columns = (count - left + TileWidth - 1) / TileWidth;
+        const size_t groups = (bottom - top + RowGroup - 1) / RowGroup;
+        tileText.resize(std::max(tileText.size(), columns * groups));
+        rowEnds.resize(std::max(rowEnds.size(), columns * RowBand));
+
+        Parallel::Pool().Run(columns * groups, [&](size_t task) {
+            const size_t column = task % columns, group = task / columns;
+            const size_t first = left + column * TileWidth, last = std::min(first + TileWidth, count);
+            const size_t rowFirst = top + group * RowGroup, rowLast = std::min(rowFirst + RowGroup, bottom);
+            std::string& text = tileText[task];
+            text.clear();
+
+            float ratio[TileWidth], deltaE[TileWidth];
+            for (size_t i = rowFirst; i < rowLast; i++) {
+                const size_t from = std::max(first, i + 1);
+                if (from < last) Row(ratio, deltaE, planes, i, from, last);
+
+                for (size_t j = from; j < last; j++) {
+                    float r = ratio[j - from], e = deltaE[j - from];
+                    // The approximation can only matter right at the threshold
+                    if (std::fabs(e - options.minDeltaE) < RowTolerance) e = PairDeltaE(planes, i, j);
+
+                    bool pass = r >= options.minRatio && e >= options.minDeltaE;
+                    if ((options.filter == Filter::Pass && !pass) || (options.filter == Filter::Fail && pass)) continue;
+
+                    text += labels[i];
+                    text += labels[j];
+                    AppendNumber(text, r);
+                    text += '\t';
+                    AppendNumber(text, e);
+                    text += '\n';
+                }
+                rowEnds[column * RowBand + (i - top)] = text.size();
+            }
+        });
+
+        // Row by row, the tiles of a row in column order
+        for (size_t i = top; i < bottom; i++) {
+            const size_t row = i - top, group = row / RowGroup;
+            for (size_t column = 0; column < columns; column++) {
+                const std::string& text = tileText[group * columns + column];
+                size_t begin = row % RowGroup == 0 ? 0 : rowEnds[column * RowBand + row - 1];
+                out.append(text, begin, rowEnds[column * RowBand + row] - begin);
+            }
+            if (out.size() >= FlushSize) {
+                if (!Utility::WriteAll(STDOUT_FILENO, out.data(), out.size())) return false;
+                out.clear();
+            }
+        }
+    }
+
+    return Utility::WriteAll(STDOUT_FILENO, out.data(), out.size());
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <span>
+#include <vector>
+#include "Color.h"
+#include "Template.h"
+
+namespace Contrast {
+
+    /** WCAG 2 relative luminance of a color, 0 for black to 1 for white. */
+    float Luminance(const Color::RGB& in);
+
+    /** WCAG 2 contrast ratio of two relative luminances, from 1 (same) to 21 (black on white). */
+    inline float Ratio(float a, float b) {
+        return a > b ? (a + 0.05f) / (b + 0.05f) : (b + 0.05f) / (a + 0.05f);
+    }
+
+    /** CIEDE2000 color difference (kL = kC = kH = 1), computed in double precision after Sharma, Wu and Dalal. */
+    float DeltaE2000(const Color::Lab& x, const Color::Lab& y);
+
+    /** Colors in the planar layout the pair kernels read, with the terms that only depend on one color. */
+    struct Planes {
+        std::vector<float> luminance;
+        std::vector<float> L;
+        std::vector<float> a;
+        std::vector<float> b;
+        std::vector<float> C;       // Chroma sqrt(a^2 + b^2)
+
+        size_t Size() const { return L.size(); }
+    };
+
+    void Prepare(Planes& out, std::span<const Color::RGB> colors);
+
+    /** Largest difference of the deltaE values of Row to DeltaE2000, checked by `make validate`. */
+    constexpr float RowTolerance = 1e-3f;
+
+    /** Contrast ratio and CIEDE2000 difference of color i against the colors [first, last), written to
+    ratio[0, last - first) and deltaE[0, last - first). Uses AVX2 or SSE4.1 kernels when the cpu supports them,
+    the ratios are exact and the differences within RowTolerance of DeltaE2000. */
+    void Row(float* ratio, float* deltaE, const Planes& planes, size_t i, size_t first, size_t last);
+
+    /** Which pairs Run prints. A pair passes when both its ratio and its difference reach the minimums. */
+    enum class Filter { All, Pass, Fail };
+
+    struct Options {
+        float minRatio = 4.5f;      // WCAG AA for normal text
+        float minDeltaE = 0.0f;
+        Filter filter = Filter::All;
+    };
+
+    /** Print the contrast ratio and CIEDE2000 difference of every pair of colors in a palette file, one tab
+    separated line per pair: color, name, color, name, ratio, deltaE. The colors are printed with the template.
+    The pair matrix is never stored: tiles of it are computed in parallel and each band of rows is written out
+    as soon as it is done, in row order. */
+    bool Run(const std::string& palettePath, const Options& options, const Template::Program& output);
+}
@@ -0,0 +1,246 @@
+#include "Convert.h"
+#include "Parallel.h"
+#include "Utility.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr size_t ChunkSize = 4 << 20;   // Bytes of input handed to one worker
+    constexpr size_t ReadSize = 1 << 20;    // Bytes read per read(2) for pipes
+    constexpr size_t FlushSize = 1 << 20;   // Output is flushed once it grows past this
+    constexpr size_t BatchSize = 256;       // Lines parsed before converting them with the batch kernels
+
+    void SkipSpaces(const char*& p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    }
+
+    /** Parse `count` comma separated numbers, optional spaces around each one. */
+    template <typename T>
+    bool ParseFields(T* values, size_t count, std::string_view in) {
+        const char* p = in.data();
+        const char* end = p + in.size();
+
+        for (size_t i = 0; i < count; i++) {
+            SkipSpaces(p, end);
+            auto [next, ec] = std::from_chars(p, end, values[i]);
+            if (ec != std::errc()) return false;
+            p = next;
+            SkipSpaces(p, end);
+            if (i + 1 < count) {
+                if (p == end || *p != ',') return false;
+                ++p;
+            }
+        }
+
+        return p == end;
+    }
+
+    bool ConvertFile(int fd, size_t size, Color::Format from, const Template::Program& to, size_t& invalid) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) return false;
+        madvise(mapped, size, MADV_SEQUENTIAL);
+
+        const char* data = static_cast<const char*>(mapped);
+        size_t workers = Parallel::Pool().Threads();
+
+        std::vector<std::string_view> chunks(workers);
+        std::vector<std::string> outputs(workers);
+        std::vector<size_t> errors(workers);
+        bool ok = true;
+
+        size_t pos = 0;
+        while (ok && pos < size) {
+            // Cut the next batch of chunks on line boundaries
+            size_t count = 0;
+            for (; count < workers && pos < size; count++) {
+                size_t end = std::min(pos + ChunkSize, size);
+                if (end < size) {
+                    const void* nl = memchr(data + end, '\n', size - end);
+                    end = nl ? static_cast<const char*>(nl) - data + 1 : size;
+                }
+                chunks[count] = std::string_view(data + pos, end - pos);
+                pos = end;
+            }
+
+            Parallel::Pool().Run(count, [&](size_t i) {
+                outputs[i].clear();
+                errors[i] = Convert::ConvertLines(outputs[i], chunks[i], from, to);
+            });
+
+            for (size_t i = 0; i < count && ok; i++) {
+                invalid += errors[i];
+                ok = Utility::WriteAll(STDOUT_FILENO, outputs[i].data(), outputs[i].size());
+            }
+        }
+
+        munmap(mapped, size);
+        return ok;
+    }
+
+    bool ConvertStream(int fd, Color::Format from, const Template::Program& to, size_t& invalid) {
+        std::vector<char> buffer(ReadSize);
+        std::string out;
+        out.reserve(FlushSize * 2);
+        size_t filled = 0;
+
+        while (true) {
+            if (filled == buffer.size()) buffer.resize(buffer.size() * 2); // Line longer than the buffer
+
+            ssize_t n = read(fd, buffer.data() + filled, buffer.size() - filled);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            if (n == 0) break;
+            filled += static_cast<size_t>(n);
+
+            // Only convert complete lines, keep the rest for the next read
+            size_t complete = filled;
+            while (complete > 0 && buffer[complete - 1] != '\n') --complete;
+            if (complete == 0) continue;
+
+            invalid += Convert::ConvertLines(out, std::string_view(buffer.data(), complete), from, to);
+            memmove(buffer.data(), buffer.data() + complete, filled - complete);
+            filled -= complete;
+
+            if (out.size() >= FlushSize) {
+                if (!Utility::WriteAll(STDOUT_FILENO, out.data(), out.size())) return false;
+                out.clear();
+            }
+        }
+
+        if (filled > 0) invalid += Convert::ConvertLines(out, std::string_view(buffer.data(), filled), from, to);
+        return Utility::WriteAll(STDOUT_FILENO, out.data(), out.size());
+    }
+}
+
+bool Convert::ParseFormat(std::string_view name, Color::Format& out) {
+    if (name == "rgb") out = Color::Format::RGB;
+    else if (name == "hex") out = Color::Format::HEX;
+    else if (name == "cmyk") out = Color::Format::CMYK;
+    else if (name == "hsl") out = Color::Format::HSL;
+    else if (name == "oklab") out = Color::Format::OKLAB;
+    else if (name == "oklch") out = Color::Format::OKLCH;
+    else if (name == "lab") out = Color::Format::LAB;
+    else return false;
+    return true;
+}
+
+bool Convert::ParseColor(Color::RGB& out, std::string_view in, Color::Format format) {
+    switch (format) {
+        case Color::Format::RGB: {
+            unsigned values[3];
+            if (!ParseFields(values, 3, in)) return false;
+            if (values[0] > 255 || values[1] > 255 || values[2] > 255) return false;
+            out = {static_cast<uint8_t>(values[0]), static_cast<uint8_t>(values[1]), static_cast<uint8_t>(values[2])};
+            return true;
+        }
+        case Color::Format::HEX:
+            return Color::DecodeHEX(out, in);
+        case Color::Format::HSL: {
+            float values[3];
+            if (!ParseFields(values, 3, in)) return false;
+            Color::HSLtoRGB(out, {values[0] / 100.0f, values[1] / 100.0f, values[2] / 100.0f});
+            return true;
+        }
+        case Color::Format::CMYK: {
+            float values[4];
+            if (!ParseFields(values, 4, in)) return false;
+            Color::CMYKtoRGB(out, {values[0] / 100.0f, values[1] / 100.0f, values[2] / 100.0f, values[3] / 100.0f});
+            return true;
+        }
+        case Color::Format::OKLAB: {
+            float values[3];
+            if (!ParseFields(values, 3, in)) return false;
+            Color::OKLabtoRGB(out, {values[0], values[1], values[2]});
+            return true;
+        }
+        case Color::Format::OKLCH: {
+            float values[3];
+            if (!ParseFields(values, 3, in)) return false;
+            Color::OKLCHtoRGB(out, {values[0], values[1], values[2]});
+            return true;
+        }
+        case Color::Format::LAB: {
+            float values[3];
+            if (!ParseFields(values, 3, in)) return false;
+            Color::LabtoRGB(out, {values[0], values[1], values[2]});
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t Convert::ConvertLines(std::string& out, std::string_view chunk, Color::Format from, const Template::Program& to) {
+    // Every output line is short, reserving once avoids regrowing while appending
+    out.reserve(out.size() + chunk.size() * 2 + to.maxSize);
+
+    size_t invalid = 0;
+    Color::RGB rgb[BatchSize];
+    bool valid[BatchSize];
+
+    while (!chunk.empty()) {
+        // Parse a batch of lines first so the color space conversion runs over whole arrays
+        size_t count = 0;
+        for (; count < BatchSize && !chunk.empty(); count++) {
+            size_t nl = chunk.find('\n');
+            std::string_view in = chunk.substr(0, nl);
+            chunk.remove_prefix(nl == std::string_view::npos ? chunk.size() : nl + 1);
+
+            if (!in.empty() && in.back() == '\r') in.remove_suffix(1);
+
+            valid[count] = ParseColor(rgb[count], in, from);
+            if (!valid[count]) {
+                rgb[count] = {0, 0, 0};
+                ++invalid;
+            }
+        }
+
+        Template::FormatLines(out, to, std::span<const Color::RGB>(rgb, count), valid);
+    }
+
+    return invalid;
+}
+
+bool Convert::Run(const std::string& path, Color::Format from, const Template::Program& to) {
+    int fd = STDIN_FILENO;
+    if (!path.empty() && path != "-") {
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Could not open '" << path << "'!\n";
+            return false;
+        }
+    }
+
+    size_t invalid = 0;
+    bool ok;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        ok = ConvertFile(fd, static_cast<size_t>(info.st_size), from, to, invalid);
+    } else {
+        ok = ConvertStream(fd, from, to, invalid);
+    }
+
+    if (fd != STDIN_FILENO) close(fd);
+
+    if (!ok) {
+        std::cerr << "Failed to convert input!\n";
+        return false;
+    }
+    if (invalid > 0) {
+        std::cerr << invalid << " invalid line(s) were left empty.\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include "Color.h"
+#include "Template.h"
+
+namespace Convert {
+
+    /** Parse the name of a format ("rgb", "hex", "cmyk", "hsl", "oklab", "oklch" or "lab"). */
+    bool ParseFormat(std::string_view name, Color::Format& out);
+
+    /** Parse a color written in the given format ("r,g,b", "#RRGGBB", "h,s,l", "c,m,y,k", OKLab and CIELAB "L,a,b"
+    or OKLCH "L,C,h"). Colors outside of sRGB are clipped.
+    Does not allocate or throw. */
+    bool ParseColor(Color::RGB& out, std::string_view in, Color::Format format);
+
+    /** Convert every line of chunk, print the colors with the template `to` and append them to out.
+    Invalid lines produce an empty output line. Returns the number of invalid lines. */
+    size_t ConvertLines(std::string& out, std::string_view chunk, Color::Format from, const Template::Program& to);
+
+    /** Convert newline separated colors from a file (stdin if path is empty or "-") and write them to stdout.
+    Regular files are memory mapped and converted in parallel chunks, output order is kept. */
+    bool Run(const std::string& path, Color::Format from, const Template::Program& to);
+}
@@ -0,0 +1,327 @@
+#include "Extract.h"
+#include "Parallel.h"
+#include "Utility.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace Extract;
+
+namespace {
+
+    constexpr size_t Side = size_t(1) << HistogramBits;     // Bins per channel
+    constexpr unsigned Shift = 8 - HistogramBits;
+
+    size_t BinIndex(size_t r, size_t g, size_t b) {
+        return (r << (2 * HistogramBits)) | (g << HistogramBits) | b;
+    }
+
+    bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    /** Skip whitespace and '#' comments between the header fields of a Netpbm file. */
+    void SkipSpaceAndComments(std::string_view& s) {
+        while (!s.empty()) {
+            if (IsSpace(s.front())) s.remove_prefix(1);
+            else if (s.front() == '#') {
+                size_t nl = s.find('\n');
+                s.remove_prefix(nl == std::string_view::npos ? s.size() : nl + 1);
+            }
+            else break;
+        }
+    }
+
+    bool ParseNumber(std::string_view& s, size_t& out) {
+        auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+        if (ec != std::errc()) return false;
+        s.remove_prefix(end - s.data());
+        return true;
+    }
+
+    /** P5 and P6: width, height and maxval, then a single whitespace before the samples. */
+    bool ParseNetpbm(Image& out, std::string_view& s, size_t channels) {
+        size_t values[3];
+        for (size_t& value : values) {
+            SkipSpaceAndComments(s);
+            if (!ParseNumber(s, value)) return false;
+        }
+        if (s.empty() || !IsSpace(s.front())) return false;
+        s.remove_prefix(1);
+
+        out.width = values[0];
+        out.height = values[1];
+        out.channels = channels;
+        out.maxval = static_cast<unsigned>(values[2]);
+        return true;
+    }
+
+    /** P7: "KEY value" lines up to ENDHDR. TUPLTYPE is not needed, DEPTH tells what the channels are. */
+    bool ParsePAM(Image& out, std::string_view& s) {
+        size_t depth = 0, maxval = 0;
+        while (true) {
+            SkipSpaceAndComments(s);
+            size_t nl = s.find('\n');
+            if (nl == std::string_view::npos) return false;
+            std::string_view line = s.substr(0, nl);
+            s.remove_prefix(nl + 1);
+
+            size_t space = line.find_first_of(" \t");
+            std::string_view key = line.substr(0, space);
+            std::string_view value = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
+            while (!value.empty() && IsSpace(value.front())) value.remove_prefix(1);
+
+            if (key == "ENDHDR") break;
+            if (key == "WIDTH" && !ParseNumber(value, out.width)) return false;
+            if (key == "HEIGHT" && !ParseNumber(value, out.height)) return false;
+            if (key == "DEPTH" && !ParseNumber(value, depth)) return false;
+            if (key == "MAXVAL" && !ParseNumber(value, maxval)) return false;
+        }
+
+        out.channels = depth;
+        out.maxval = static_cast<unsigned>(maxval);
+        return true;
+    }
+
+    /** Sample i of a pixel, still in the image's own range. */
+    template <bool Wide>
+    unsigned Sample(const uint8_t* pixel, size_t i) {
+        if constexpr (Wide) return (unsigned(pixel[2 * i]) << 8) | pixel[2 * i + 1];
+        else return pixel[i];
+    }
+
+    /** Count rows [first, last) of an image. scale maps every possible sample value to 0-255. */
+    template <bool Wide>
+    void CountRows(Bin* bins, const Image& image, const uint8_t* scale, size_t first, size_t last) {
+        const size_t stride = image.channels * (Wide ? 2 : 1);
+        const bool gray = image.channels <= 2;
+        const bool alpha = image.channels == 2 || image.channels == 4;
+
+        for (size_t y = first; y < last; y++) {
+            const uint8_t* pixel = image.samples + y * image.width * stride;
+            for (size_t x = 0; x < image.width; x++, pixel += stride) {
+                if (alpha && scale[Sample<Wide>(pixel, image.channels - 1)] < 128) continue;
+
+                uint8_t r = scale[Sample<Wide>(pixel, 0)];
+                uint8_t g = gray ? r : scale[Sample<Wide>(pixel, 1)];
+                uint8_t b = gray ? r : scale[Sample<Wide>(pixel, 2)];
+
+                Bin& bin = bins[BinIndex(r >> Shift, g >> Shift, b >> Shift)];
+                bin.count++;
+                bin.r += r;
+                bin.g += g;
+                bin.b += b;
+            }
+        }
+    }
+
+    /** A box of histogram bins, inclusive bounds in bin coordinates. */
+    struct Box {
+        size_t lo[3];
+        size_t hi[3];
+        uint64_t count;
+
+        size_t Volume() const { return (hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1); }
+    };
+
+    template <typename F>
+    void ForEachBin(const Box& box, F&& f) {
+        for (size_t r = box.lo[0]; r <= box.hi[0]; r++)
+            for (size_t g = box.lo[1]; g <= box.hi[1]; g++)
+                for (size_t b = box.lo[2]; b <= box.hi[2]; b++)
+                    f(r, g, b);
+    }
+
+    /** Count the pixels in a box and shrink it to the bins that are not empty. Returns false if it is empty. */
+    bool Shrink(Box& box, const Histogram& histogram) {
+        Box tight{{Side, Side, Side}, {0, 0, 0}, 0};
+        ForEachBin(box, [&](size_t r, size_t g, size_t b) {
+            uint64_t count = histogram[BinIndex(r, g, b)].count;
+            if (count == 0) return;
+            size_t c[3] = {r, g, b};
+            for (size_t i = 0; i < 3; i++) {
+                tight.lo[i] = std::min(tight.lo[i], c[i]);
+                tight.hi[i] = std::max(tight.hi[i], c[i]);
+            }
+            tight.count += count;
+        });
+        if (tight.count == 0) return false;
+        box = tight;
+        return true;
+    }
+
+    /** Cut a box in two along its longest side, at the median pixel. Both halves keep at least one bin. */
+    void Split(Box& box, Box& other, const Histogram& histogram) {
+        size_t axis = 0;
+        for (size_t i = 1; i < 3; i++) {
+            if (box.hi[i] - box.lo[i] > box.hi[axis] - box.lo[axis]) axis = i;
+        }
+
+        uint64_t along[Side] = {};
+        ForEachBin(box, [&](size_t r, size_t g, size_t b) {
+            size_t c[3] = {r, g, b};
+            along[c[axis]] += histogram[BinIndex(r, g, b)].count;
+        });
+
+        size_t cut = box.lo[axis];
+        uint64_t below = along[cut];
+        while (cut + 1 < box.hi[axis] && below * 2 < box.count) below += along[++cut];
+
+        other = box;
+        box.hi[axis] = cut;
+        other.lo[axis] = cut + 1;
+        Shrink(box, histogram);
+        Shrink(other, histogram);
+    }
+}
+
+bool Extract::ParseImage(Image& out, std::string_view file) {
+    if (file.size() < 2 || file[0] != 'P') return false;
+    char kind = file[1];
+    std::string_view rest = file.substr(2);
+
+    out = {};
+    bool parsed = false;
+    if (kind == '5') parsed = ParseNetpbm(out, rest, 1);
+    else if (kind == '6') parsed = ParseNetpbm(out, rest, 3);
+    else if (kind == '7') parsed = ParsePAM(out, rest);
+    if (!parsed || out.width == 0 || out.height == 0 || out.channels < 1 || out.channels > 4 ||
+        out.maxval < 1 || out.maxval > 65535) {
+        return false;
+    }
+
+    // Checked by division, width * height of a corrupt header could overflow
+    size_t pixelSize = out.channels * (out.maxval > 255 ? 2 : 1);
+    if (rest.size() / pixelSize / out.width < out.height) return false;
+
+    out.samples = reinterpret_cast<const uint8_t*>(rest.data());
+    return true;
+}
+
+void Extract::BuildHistogram(Histogram& out, const Image& image) {
+    out.assign(HistogramSize, Bin{});
+
+    // Samples are scaled to 8 bits through a table, out of range values in a broken file are clamped
+    const bool wide = image.maxval > 255;
+    std::vector<uint8_t> scale(wide ? 65536 : 256, 255);
+    for (unsigned v = 0; v <= image.maxval; v++) scale[v] = static_cast<uint8_t>((v * 255 + image.maxval / 2) / image.maxval);
+
+    // Every band counts into its own histogram so no bin is shared between threads
+    size_t bands = Parallel::Bands(image.height, image.width * image.height);
+    std::vector<Histogram> partial(bands - 1, Histogram(HistogramSize, Bin{}));
+    Parallel::Pool().Run(bands, [&](size_t band) {
+        Bin* bins = band == 0 ? out.data() : partial[band - 1].data();
+        size_t first = band * image.height / bands, last = (band + 1) * image.height / bands;
+        if (wide) CountRows<true>(bins, image, scale.data(), first, last);
+        else CountRows<false>(bins, image, scale.data(), first, last);
+    });
+
+    for (const Histogram& histogram : partial) {
+        for (size_t i = 0; i < HistogramSize; i++) {
+            out[i].count += histogram[i].count;
+            out[i].r += histogram[i].r;
+            out[i].g += histogram[i].g;
+            out[i].b += histogram[i].b;
+        }
+    }
+}
+
+std::vector<Swatch> Extract::MedianCut(const Histogram& histogram, size_t count) {
+    std::vector<Box> boxes;
+    Box all{{0, 0, 0}, {Side - 1, Side - 1, Side - 1}, 0};
+    if (count == 0 || !Shrink(all, histogram)) return {};
+    boxes.push_back(all);
+
+    // Splitting the most populated box first finds the large areas, but never gets to small vivid ones.
+    // The last quarter of the cuts goes to the boxes with the most pixels times volume instead.
+    size_t byCount = std::max<size_t>(1, count * 3 / 4);
+    while (boxes.size() < count) {
+        bool weighVolume = boxes.size() >= byCount;
+        Box* next = nullptr;
+        uint64_t best = 0;
+        for (Box& box : boxes) {
+            if (box.Volume() <= 1) continue;
+            uint64_t score = weighVolume ? box.count * box.Volume() : box.count;
+            if (score > best) {
+                best = score;
+                next = &box;
+            }
+        }
+        if (!next) break; // Every box is a single bin
+
+        Box other;
+        Split(*next, other, histogram);
+        boxes.push_back(other);
+    }
+
+    std::vector<Swatch> swatches;
+    for (const Box& box : boxes) {
+        uint64_t sum[3] = {0, 0, 0};
+        ForEachBin(box, [&](size_t r, size_t g, size_t b) {
+            const Bin& bin = histogram[BinIndex(r, g, b)];
+            sum[0] += bin.r;
+            sum[1] += bin.g;
+            sum[2] += bin.b;
+        });
+        Color::RGB rgb;
+        rgb.r = static_cast<uint8_t>((sum[0] + box.count / 2) / box.count);
+        rgb.g = static_cast<uint8_t>((sum[1] + box.count / 2) / box.count);
+        rgb.b = static_cast<uint8_t>((sum[2] + box.count / 2) / box.count);
+        swatches.push_back({rgb, box.count});
+    }
+
+    std::stable_sort(swatches.begin(), swatches.end(),
+        [](const Swatch& a, const Swatch& b) { return a.pixels > b.pixels; });
+    return swatches;
+}
+
+bool Extract::Run(const std::string& path, size_t count, const Template::Program& output) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open '" << path << "'!\n";
+        return false;
+    }
+
+    struct stat info;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Could not read '" << path << "'!\n";
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    madvise(mapped, size, MADV_WILLNEED);
+
+    Image image;
+    Histogram histogram;
+    bool valid = ParseImage(image, std::string_view(static_cast<const char*>(mapped), size));
+    if (valid) BuildHistogram(histogram, image);
+    munmap(mapped, size);
+
+    if (!valid) {
+        std::cerr << "'" << path << "' is not a binary PPM, PGM or PAM image!\n";
+        return false;
+    }
+
+    std::vector<Swatch> swatches = MedianCut(histogram, count);
+    if (swatches.empty()) {
+        std::cerr << "'" << path << "' has no opaque pixels!\n";
+        return false;
+    }
+
+    std::vector<Color::RGB> colors;
+    colors.reserve(swatches.size());
+    for (const Swatch& swatch : swatches) colors.push_back(swatch.rgb);
+
+    std::string out;
+    Template::FormatLines(out, output, colors);
+    return Utility::WriteAll(STDOUT_FILENO, out.data(), out.size());
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Color.h"
+#include "Template.h"
+
+namespace Extract {
+
+    /** Bits kept per channel when pixels are counted, 5 gives 32768 bins. */
+    constexpr size_t HistogramBits = 5;
+    constexpr size_t HistogramSize = size_t(1) << (3 * HistogramBits);
+
+    /** Pixels that fell into a bin, and the sum of their channels to average them later. */
+    struct Bin {
+        uint64_t count;
+        uint64_t r, g, b;
+    };
+    typedef std::vector<Bin> Histogram;
+
+    /** Pixel data of a PPM, PGM or PAM file, pointing into the file contents. */
+    struct Image {
+        size_t width = 0;
+        size_t height = 0;
+        size_t channels = 0;        // 1 gray, 2 gray + alpha, 3 RGB, 4 RGB + alpha
+        unsigned maxval = 0;        // Samples above 255 take two bytes (big endian)
+        const uint8_t* samples = nullptr;
+    };
+
+    /** A color picked for the palette and how many pixels it stands for. */
+    struct Swatch {
+        Color::RGB rgb;
+        uint64_t pixels;
+    };
+
+    /** Parse the header of a binary PPM (P6), PGM (P5) or PAM (P7) file.
+    Returns false if the format is not supported or the pixel data is truncated. */
+    bool ParseImage(Image& out, std::string_view file);
+
+    /** Count the pixels of an image into a histogram of HistogramSize bins.
+    Row bands are counted in parallel, each into its own histogram, and merged at the end.
+    Pixels that are more than half transparent are skipped. */
+    void BuildHistogram(Histogram& out, const Image& image);
+
+    /** Pick up to `count` colors that represent the histogram by median cut, most common first. */
+    std::vector<Swatch> MedianCut(const Histogram& histogram, size_t count);
+
+    /** Print the `count` dominant colors of an image file with the given template, one per line.
+    The file is memory mapped, so images of any size are read without copying them. */
+    bool Run(const std::string& path, size_t count, const Template::Program& output);
+}
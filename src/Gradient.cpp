@@ -0,0 +1,195 @@
+#include "Gradient.h"
+#include "Convert.h"
+#include "Render.h"
+#include "Utility.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+using namespace Gradient;
+
+namespace {
+
+    constexpr size_t ChunkSize = 4096;      // Steps interpolated and formatted at a time
+    constexpr size_t FlushSize = 1 << 20;   // Output is written once it grows past this
+    constexpr size_t PreviewWidth = 64;     // Cells of the --preview strip
+    constexpr float AchromaticLimit = 1e-4f; // Saturation or chroma below this has no meaningful hue
+
+    /** A stop in the interpolation space, the components in the order of the space's struct. */
+    struct Point {
+        float v[3];
+    };
+
+    /** RGB interpolates in plain 0-255 floats. */
+    void PointToRGB(std::span<Color::RGB> out, std::span<const Point> in) {
+        for (size_t i = 0; i < out.size(); i++) {
+            out[i].r = static_cast<uint8_t>(std::clamp(in[i].v[0], 0.0f, 255.0f) + 0.5f);
+            out[i].g = static_cast<uint8_t>(std::clamp(in[i].v[1], 0.0f, 255.0f) + 0.5f);
+            out[i].b = static_cast<uint8_t>(std::clamp(in[i].v[2], 0.0f, 255.0f) + 0.5f);
+        }
+    }
+
+    /** Hue position and full circle of a space, or no hue at all. */
+    struct HueAxis {
+        int axis;           // Component holding the hue, -1 if there is none
+        int chromaAxis;     // Component that is 0 for grays
+        float range;
+    };
+
+    HueAxis HueOf(Space space) {
+        switch (space) {
+            case Space::HSL: return {0, 1, 1.0f};
+            case Space::OKLCH: return {2, 1, 360.0f};
+            default: return {-1, -1, 0.0f};
+        }
+    }
+
+    std::vector<Point> ToPoints(std::span<const Color::RGB> stops, Space space) {
+        std::vector<Point> points(stops.size());
+        for (size_t i = 0; i < stops.size(); i++) {
+            float* v = points[i].v;
+            switch (space) {
+                case Space::RGB:
+                    v[0] = stops[i].r; v[1] = stops[i].g; v[2] = stops[i].b;
+                    break;
+                case Space::HSL: {
+                    Color::HSL hsl;
+                    Color::RGBtoHSL(hsl, stops[i]);
+                    v[0] = hsl.h; v[1] = hsl.s; v[2] = hsl.l;
+                    break;
+                }
+                case Space::OKLAB: {
+                    Color::OKLab lab;
+                    Color::RGBtoOKLab(lab, stops[i]);
+                    v[0] = lab.L; v[1] = lab.a; v[2] = lab.b;
+                    break;
+                }
+                case Space::OKLCH: {
+                    Color::OKLCH lch;
+                    Color::RGBtoOKLCH(lch, stops[i]);
+                    v[0] = lch.L; v[1] = lch.C; v[2] = lch.h;
+                    break;
+                }
+            }
+        }
+        return points;
+    }
+
+    /** Point at t between a and b. Hues go the shorter way around, a gray end takes the hue of the other end. */
+    Point Mix(const Point& a, const Point& b, float t, const HueAxis& hue) {
+        Point out;
+        for (int i = 0; i < 3; i++) {
+            if (i != hue.axis) {
+                out.v[i] = a.v[i] + (b.v[i] - a.v[i]) * t;
+                continue;
+            }
+
+            float from = a.v[i], to = b.v[i];
+            if (a.v[hue.chromaAxis] < AchromaticLimit) from = to;
+            if (b.v[hue.chromaAxis] < AchromaticLimit) to = from;
+
+            float delta = to - from;
+            if (delta > hue.range / 2) delta -= hue.range;
+            else if (delta < -hue.range / 2) delta += hue.range;
+
+            float h = from + delta * t;
+            out.v[i] = h < 0.0f ? h + hue.range : (h >= hue.range ? h - hue.range : h);
+        }
+        return out;
+    }
+
+    /** Interpolate a chunk of steps into space T and convert it to RGB with the batch conversion of that space. */
+    template <typename T>
+    void SampleIn(std::span<Color::RGB> out, const std::vector<Point>& points, const HueAxis& hue, size_t first,
+                  size_t steps, void (*convert)(std::span<Color::RGB>, std::span<const T>)) {
+        T mixed[ChunkSize];
+        const size_t segments = points.size() - 1;
+
+        for (size_t done = 0; done < out.size(); done += ChunkSize) {
+            size_t count = std::min(ChunkSize, out.size() - done);
+            for (size_t i = 0; i < count; i++) {
+                // Double keeps the position exact enough for gradients with millions of steps
+                double position = steps > 1 ? double(first + done + i) * segments / (steps - 1) : 0.0;
+                size_t segment = std::min(static_cast<size_t>(position), segments - 1);
+                Point p = Mix(points[segment], points[segment + 1], static_cast<float>(position - segment), hue);
+                mixed[i] = T{p.v[0], p.v[1], p.v[2]};
+            }
+            convert(out.subspan(done, count), std::span<const T>(mixed, count));
+        }
+    }
+}
+
+bool Gradient::ParseStops(std::vector<Color::RGB>& out, std::string_view list, Color::Format format) {
+    size_t fields = format == Color::Format::HEX ? 1 : (format == Color::Format::CMYK ? 4 : 3);
+
+    out.clear();
+    while (!list.empty()) {
+        // A color ends after its last field, the commas between its own fields belong to it
+        size_t end = 0;
+        for (size_t i = 0; i < fields; i++) {
+            end = list.find(',', i == 0 ? 0 : end + 1);
+            if (end == std::string_view::npos) {
+                if (i + 1 < fields) return false;
+                end = list.size();
+            }
+        }
+
+        Color::RGB rgb;
+        if (!Convert::ParseColor(rgb, list.substr(0, end), format)) return false;
+        out.push_back(rgb);
+        list.remove_prefix(std::min(end + 1, list.size()));
+    }
+
+    return out.size() >= 2;
+}
+
+void Gradient::Sample(std::span<Color::RGB> out, std::span<const Color::RGB> stops, Space space, size_t first,
+                      size_t steps) {
+    if (stops.size() < 2) {
+        std::fill(out.begin(), out.end(), stops.empty() ? Color::RGB{0, 0, 0} : stops[0]);
+        return;
+    }
+
+    std::vector<Point> points = ToPoints(stops, space);
+    HueAxis hue = HueOf(space);
+    switch (space) {
+        case Space::RGB: SampleIn<Point>(out, points, hue, first, steps, PointToRGB); break;
+        case Space::HSL: SampleIn<Color::HSL>(out, points, hue, first, steps, Color::HSLtoRGB); break;
+        case Space::OKLAB: SampleIn<Color::OKLab>(out, points, hue, first, steps, Color::OKLabtoRGB); break;
+        case Space::OKLCH: SampleIn<Color::OKLCH>(out, points, hue, first, steps, Color::OKLCHtoRGB); break;
+    }
+}
+
+bool Gradient::Run(std::span<const Color::RGB> stops, size_t steps, Space space, const Template::Program& output, bool preview) {
+    if (preview) {
+        // One row of cells, both pixels of a cell the same color
+        Render::RenderBuffer strip{std::min(steps, PreviewWidth), 2, {}};
+        strip.pixels.resize(strip.width * 2);
+        Sample(std::span(strip.pixels.data(), strip.width), stops, space, 0, strip.width);
+        std::copy_n(strip.pixels.begin(), strip.width, strip.pixels.begin() + strip.width);
+
+        std::string ansi;
+        Render::RenderANSIString(ansi, strip);
+        if (!Utility::WriteAll(STDERR_FILENO, ansi.data(), ansi.size())) return false;
+    }
+
+    // Colors and text are produced a chunk at a time into buffers that are reused until the end
+    std::vector<Color::RGB> chunk(ChunkSize);
+    std::string out;
+    out.reserve(FlushSize + ChunkSize * (output.maxSize + 1));
+
+    for (size_t first = 0; first < steps; first += ChunkSize) {
+        std::span<Color::RGB> colors(chunk.data(), std::min(ChunkSize, steps - first));
+        Sample(colors, stops, space, first, steps);
+        Template::FormatLines(out, output, colors);
+
+        if (out.size() >= FlushSize) {
+            if (!Utility::WriteAll(STDOUT_FILENO, out.data(), out.size())) return false;
+            out.clear();
+        }
+    }
+
+    return Utility::WriteAll(STDOUT_FILENO, out.data(), out.size());
+}
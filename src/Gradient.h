@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "Color.h"
+#include "Template.h"
+
+namespace Gradient {
+
+    /** Color space a gradient is interpolated in. HSL and OKLCH take the shorter way around the hue circle. */
+    enum class Space { RGB, HSL, OKLAB, OKLCH };
+
+    /** Parse a comma separated list of colors written in the given format, e.g. "255,0,0,0,0,255" for two RGB colors.
+    Returns false unless the list holds at least two valid colors. */
+    bool ParseStops(std::vector<Color::RGB>& out, std::string_view list, Color::Format format);
+
+    /** Fill out with steps [first, first + out.size()) of a gradient with `steps` evenly spaced steps
+    that runs through all stops, the first step being the first stop and the last step the last one. */
+    void Sample(std::span<Color::RGB> out, std::span<const Color::RGB> stops, Space space, size_t first, size_t steps);
+
+    /** Print every step of a gradient to stdout with the given template, one per line.
+    With preview the gradient is drawn to stderr as a strip of colored cells too. */
+    bool Run(std::span<const Color::RGB> stops, size_t steps, Space space, const Template::Program& output, bool preview);
+}
@@ -1,40 +1,345 @@
 #include "Input.h"
-#include <iostream>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <poll.h>
+#include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 
-int getch() {
-    struct termios oldt, newt;
-    int ch;
+namespace {
+    constexpr size_t ReadSize = 256;
+    constexpr int EscapeTimeout = 50;       // ms to wait for the rest of a sequence before taking ESC as a key
+    constexpr size_t MaxSequenceSize = 32;  // Longer CSI sequences are dropped
 
-    // Get current terminal settings
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
+    const char mouseOn[] = "\033[?1000h\033[?1002h\033[?1006h";
+    const char mouseOff[] = "\033[?1006l\033[?1002l\033[?1000l";
 
-    // Disable canonical mode and echo
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+    // Saved for the signal handler, which may only touch async-signal-safe state
+    struct termios savedSettings;
+    volatile sig_atomic_t settingsSaved = 0;
+    volatile sig_atomic_t mouseEnabled = 0;
+    volatile sig_atomic_t resizePending = 0;
 
-    // Read one character
-    ch = getchar();
+    void recordResize(int) {
+        resizePending = 1;
+    }
 
-    // Restore terminal settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    void restoreAndReraise(int sig) {
+        if (mouseEnabled) (void)!write(STDERR_FILENO, mouseOff, sizeof(mouseOff) - 1);
+        if (settingsSaved) tcsetattr(STDIN_FILENO, TCSANOW, &savedSettings);
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
 
-    return ch;
+    /** Parse the numeric parameters of a CSI ("1;5" or "<0;12;7"), at most `count`. Returns how many were found. */
+    size_t ParseParams(const std::string& sequence, size_t* params, size_t count) {
+        size_t found = 0;
+        size_t value = 0;
+        bool digits = false;
+        for (char c : sequence) {
+            if (c >= '0' && c <= '9') {
+                value = value * 10 + static_cast<size_t>(c - '0');
+                digits = true;
+            } else if (c == ';') {
+                if (found < count) params[found++] = value;
+                value = 0;
+                digits = false;
+            }
+        }
+        if (digits && found < count) params[found++] = value;
+        return found;
+    }
+
+    Input::Decoder::Result KeyResult(Input::Key key) {
+        Input::Decoder::Result result{};
+        result.type = Input::Decoder::Type::Key;
+        result.key = key;
+        return result;
+    }
+
+    Input::Decoder::Result CharResult(char ch) {
+        Input::Decoder::Result result{};
+        result.type = Input::Decoder::Type::Char;
+        result.ch = ch;
+        return result;
+    }
+
+    /** Keys ending in a letter, shared by CSI and SS3 ("\033[A" and "\033OA"). */
+    Input::Decoder::Result LetterKey(char final) {
+        switch (final) {
+            case 'A': return KeyResult(Input::Key::Up);
+            case 'B': return KeyResult(Input::Key::Down);
+            case 'C': return KeyResult(Input::Key::Right);
+            case 'D': return KeyResult(Input::Key::Left);
+            case 'H': return KeyResult(Input::Key::Home);
+            case 'F': return KeyResult(Input::Key::End);
+        }
+        return {};
+    }
+}
+
+Input::Terminal::Terminal() {
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &savedSettings) != 0) return;
+    settingsSaved = 1;
+
+    signal(SIGINT, restoreAndReraise);
+    signal(SIGTERM, restoreAndReraise);
+
+    // Without SA_RESTART so a blocking poll() returns as soon as the window changes
+    struct sigaction resize = {};
+    resize.sa_handler = recordResize;
+    sigemptyset(&resize.sa_mask);
+    sigaction(SIGWINCH, &resize, nullptr);
+
+    // Disable canonical mode and echo, reads return as soon as one byte is available
+    struct termios raw = savedSettings;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    active = true;
+}
+
+Input::Terminal::~Terminal() {
+    restore();
+}
+
+void Input::Terminal::enableMouse() {
+    if (!active || mouseEnabled) return;
+    (void)!write(STDERR_FILENO, mouseOn, sizeof(mouseOn) - 1);
+    mouseEnabled = 1;
+}
+
+void Input::Terminal::restore() {
+    if (!active) return;
+    if (mouseEnabled) (void)!write(STDERR_FILENO, mouseOff, sizeof(mouseOff) - 1);
+    mouseEnabled = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &savedSettings);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGWINCH, SIG_DFL);
+    settingsSaved = 0;
+    active = false;
+}
+
+void Input::Terminal::queryMode(size_t mode) {
+    if (!active) return;
+    std::string query = "\033[?" + std::to_string(mode) + "$p";
+    (void)!write(STDERR_FILENO, query.data(), query.size());
+}
+
+bool Input::Terminal::windowSize(size_t& cols, size_t& rows) const {
+    struct winsize size;
+    if (ioctl(STDERR_FILENO, TIOCGWINSZ, &size) != 0 && ioctl(STDIN_FILENO, TIOCGWINSZ, &size) != 0) return false;
+    if (size.ws_col == 0 || size.ws_row == 0) return false;
+    cols = size.ws_col;
+    rows = size.ws_row;
+    return true;
+}
+
+bool Input::Terminal::takeResize() {
+    if (!resizePending) return false;
+    resizePending = 0;
+    return true;
+}
+
+
+size_t Input::Decoder::feed(char byte, Result (&out)[2]) {
+    switch (state) {
+        case State::Ground:
+            if (byte == '\033') {
+                state = State::Escape;
+                return 0;
+            }
+            out[0] = CharResult(byte);
+            return 1;
+
+        case State::Escape:
+            if (byte == '[') {
+                state = State::CSI;
+                sequence.clear();
+                return 0;
+            }
+            if (byte == 'O') {
+                state = State::SS3;
+                return 0;
+            }
+            // Not a sequence: ESC followed by a regular byte, or a second ESC that may start one
+            out[0] = CharResult('\033');
+            if (byte == '\033') return 1;
+            state = State::Ground;
+            out[1] = CharResult(byte);
+            return 2;
+
+        case State::SS3:
+            state = State::Ground;
+            out[0] = LetterKey(byte);
+            return out[0].type == Type::None ? 0 : 1;
+
+        case State::CSI: {
+            unsigned char c = static_cast<unsigned char>(byte);
+            if (c >= 0x40 && c <= 0x7E) {
+                state = State::Ground;
+                out[0] = finishCSI(byte);
+                return out[0].type == Type::None ? 0 : 1;
+            }
+            if (c < 0x20 || sequence.size() >= MaxSequenceSize) {
+                // Broken sequence, drop it
+                state = State::Ground;
+                return 0;
+            }
+            sequence += byte;
+            return 0;
+        }
+    }
+    return 0;
+}
+
+Input::Decoder::Result Input::Decoder::finishCSI(char final) {
+    // SGR mouse report: "<button;col;row" ended by M (press/drag) or m (release)
+    if (!sequence.empty() && sequence[0] == '<' && (final == 'M' || final == 'm')) {
+        size_t params[3];
+        if (ParseParams(sequence, params, 3) != 3) return {};
+
+        Result result{};
+        result.type = Type::Mouse;
+        result.mouse.button = static_cast<uint8_t>(params[0] & ~static_cast<size_t>(4 | 8 | 16 | 32));
+        result.mouse.action = final == 'm' ? MouseAction::Release
+                            : (params[0] & 32) ? MouseAction::Drag : MouseAction::Press;
+        result.mouse.col = params[1];
+        result.mouse.row = params[2];
+        return result;
+    }
+
+    // Cursor position report: "row;col" ended by R, only while a query is unanswered
+    if (final == 'R' && cursorQueries > 0) {
+        size_t params[2];
+        if (ParseParams(sequence, params, 2) != 2) return {};
+
+        --cursorQueries;
+        Result result{};
+        result.type = Type::Cursor;
+        result.row = params[0];
+        result.col = params[1];
+        return result;
+    }
+
+    // DEC private mode report: "?mode;value$" ended by y
+    if (final == 'y' && sequence.size() > 1 && sequence[0] == '?' && sequence.back() == '$') {
+        size_t params[2];
+        if (ParseParams(sequence, params, 2) != 2) return {};
+
+        Result result{};
+        result.type = Type::Mode;
+        result.mode = params[0];
+        result.value = params[1];
+        return result;
+    }
+
+    if (final == '~') {
+        size_t code = 0;
+        if (ParseParams(sequence, &code, 1) != 1) return {};
+        switch (code) {
+            case 1: case 7: return KeyResult(Key::Home);
+            case 4: case 8: return KeyResult(Key::End);
+            case 5: return KeyResult(Key::PageUp);
+            case 6: return KeyResult(Key::PageDown);
+        }
+        return {};
+    }
+
+    return LetterKey(final);
+}
+
+Input::Decoder::Result Input::Decoder::flush() {
+    bool loneEscape = state == State::Escape;
+    state = State::Ground;
+    return loneEscape ? CharResult('\033') : Result{};
 }
 
 
 void Input::Manager::addEvent(const char key, Input::Handler eventHandler) {
-    events.push_back({key, eventHandler});
+    handlers[static_cast<unsigned char>(key)] = eventHandler;
+}
+
+void Input::Manager::addKeyEvent(Input::Key key, Input::KeyHandler eventHandler) {
+    keyHandlers[static_cast<size_t>(key)] = eventHandler;
+}
+
+void Input::Manager::setMouseHandler(Input::MouseHandler eventHandler) {
+    mouseHandler = eventHandler;
+}
+
+void Input::Manager::setCursorHandler(Input::CursorHandler eventHandler) {
+    cursorHandler = eventHandler;
+}
+
+void Input::Manager::setModeHandler(Input::ModeHandler eventHandler) {
+    modeHandler = eventHandler;
+}
+
+void Input::Manager::dispatch(Decoder::Result& result) {
+    switch (result.type) {
+        case Decoder::Type::Char: {
+            Handler handler = handlers[static_cast<unsigned char>(result.ch)];
+            if (handler) (*handler)(result.ch);
+            break;
+        }
+        case Decoder::Type::Key: {
+            KeyHandler handler = keyHandlers[static_cast<size_t>(result.key)];
+            if (handler) (*handler)(result.key);
+            break;
+        }
+        case Decoder::Type::Mouse:
+            if (mouseHandler) (*mouseHandler)(result.mouse);
+            break;
+        case Decoder::Type::Cursor:
+            if (cursorHandler) (*cursorHandler)(result.row, result.col);
+            break;
+        case Decoder::Type::Mode:
+            if (modeHandler) (*modeHandler)(result.mode, result.value);
+            break;
+        case Decoder::Type::None:
+            break;
+    }
 }
 
-void Input::Manager::update() {
-    char key = getch();
+int Input::Manager::update(int timeout) {
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, timeout) <= 0) return 0;
+
+    // One read returns everything that queued up while the last frame was drawn
+    char keys[ReadSize];
+    int total = 0;
+
+    while (true) {
+        ssize_t count;
+        do {
+            count = read(STDIN_FILENO, keys, sizeof(keys));
+        } while (count < 0 && errno == EINTR);
 
-    size_t eventCount = events.size();
-    for (size_t i = 0; i < eventCount; i++) {
-        Input::Event event = events[i];
-        if (event.key == key) (*event.eventHandler)(key);
+        if (count <= 0) {
+            Decoder::Result result = decoder.flush();
+            dispatch(result);
+            return total > 0 ? total : -1;
+        }
+        total += static_cast<int>(count);
+
+        for (ssize_t k = 0; k < count; k++) {
+            Decoder::Result results[2];
+            size_t decoded = decoder.feed(keys[k], results);
+            for (size_t i = 0; i < decoded; i++) dispatch(results[i]);
+        }
+
+        if (!decoder.pending()) return total;
+
+        // Wait briefly for the rest of the sequence, a lone ESC is a key press of its own
+        if (poll(&pfd, 1, EscapeTimeout) <= 0) {
+            Decoder::Result result = decoder.flush();
+            dispatch(result);
+            return total;
+        }
     }
-}
\ No newline at end of file
+}
@@ -1,21 +1,128 @@
 #pragma once
 
-#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 
 namespace Input {
     typedef void (*Handler)(char&);
 
-    struct Event {
-        const char key;
-        Handler eventHandler;
+    /** Keys that arrive as CSI or SS3 escape sequences. */
+    enum class Key : uint8_t { Up, Down, Left, Right, Home, End, PageUp, PageDown, Count };
+
+    enum class MouseAction : uint8_t { Press, Drag, Release };
+
+    /** A SGR (1006) mouse report. Columns and rows are 1-based screen positions, like the terminal sends them. */
+    struct MouseEvent {
+        MouseAction action;
+        uint8_t button;   // 0 left, 1 middle, 2 right, 64/65 wheel
+        size_t col;
+        size_t row;
+    };
+
+    typedef void (*KeyHandler)(Key);
+    typedef void (*MouseHandler)(const MouseEvent&);
+    typedef void (*CursorHandler)(size_t row, size_t col);
+    typedef void (*ModeHandler)(size_t mode, size_t value);
+
+    /** Puts the terminal into non-canonical, no-echo mode for its whole lifetime.
+    The previous settings are restored on destruction and when SIGINT or SIGTERM arrive.
+    SIGWINCH is recorded so the caller can pick it up with takeResize(). */
+    class Terminal {
+    private:
+        bool active = false;
+    public:
+        Terminal();
+        ~Terminal();
+
+        Terminal(const Terminal&) = delete;
+        Terminal& operator=(const Terminal&) = delete;
+
+        /** True if stdin is a terminal that was switched to raw mode. */
+        bool isActive() const { return active; }
+
+        /** Ask the terminal to report mouse presses and drags as SGR (1006) sequences. Turned off again on restore. */
+        void enableMouse();
+
+        /** Ask the terminal whether it knows a private (DEC) mode. The answer arrives as a mode report,
+        terminals that do not understand the query stay silent. */
+        void queryMode(size_t mode);
+
+        /** Size of the terminal the UI is drawn on. Returns false if it is not a terminal. */
+        bool windowSize(size_t& cols, size_t& rows) const;
+
+        /** True once after every SIGWINCH. */
+        bool takeResize();
+
+        /** Restore the original terminal settings early. Safe to call more than once. */
+        void restore();
+    };
+
+    /** Incremental decoder that turns raw input bytes into chars, keys, mouse reports, cursor position reports
+    and mode reports.
+    Sequences may be split across reads; an incomplete sequence stays pending until more bytes or flush(). */
+    class Decoder {
+    public:
+        enum class Type : uint8_t { None, Char, Key, Mouse, Cursor, Mode };
+
+        struct Result {
+            Type type;
+            char ch;
+            Key key;
+            MouseEvent mouse;
+            size_t row;
+            size_t col;
+            size_t mode;   // DECRPM: mode number and its state (0 unknown, 1 set, 2 reset, 3/4 permanently set/reset)
+            size_t value;
+        };
+    private:
+        enum class State : uint8_t { Ground, Escape, CSI, SS3 };
+
+        State state = State::Ground;
+        std::string sequence;  // Parameter and intermediate bytes of the CSI in progress
+        size_t cursorQueries = 0;  // Cursor position queries the terminal has not answered yet
+
+        Result finishCSI(char final);
+    public:
+        /** Feed one byte and write the events it completes to out. Returns how many were written (0 to 2,
+        an ESC that does not start a sequence is reported as a char before the byte after it). */
+        size_t feed(char byte, Result (&out)[2]);
+
+        /** True while a sequence is incomplete. */
+        bool pending() const { return state != State::Ground; }
+
+        /** Note that a cursor position query (CSI 6n) was sent. "CSI row;col R" is only decoded as a cursor report
+        while a query is unanswered, otherwise it is a key like modified F3 ("CSI 1;2 R" for Shift+F3). */
+        void expectCursorReport() { ++cursorQueries; }
+
+        /** Give up on an incomplete sequence. A lone ESC is returned as the ESC char. */
+        Result flush();
     };
 
     class Manager {
     private:
-        std::vector<Event> events;
+        Handler handlers[256] = {};
+        KeyHandler keyHandlers[static_cast<size_t>(Key::Count)] = {};
+        MouseHandler mouseHandler = nullptr;
+        CursorHandler cursorHandler = nullptr;
+        ModeHandler modeHandler = nullptr;
+        Decoder decoder;
+
+        void dispatch(Decoder::Result& result);
     public:
         void addEvent(const char key, Handler eventHandler);
+        void addKeyEvent(Key key, KeyHandler eventHandler);
+        void setMouseHandler(MouseHandler eventHandler);
+        void setCursorHandler(CursorHandler eventHandler);
+        void setModeHandler(ModeHandler eventHandler);
+
+        /** Call after sending a cursor position query, see Decoder::expectCursorReport. */
+        void expectCursorReport() { decoder.expectCursorReport(); }
 
-        void update();
+        /** Wait up to timeout ms (-1 for no limit) for input, then dispatch everything that is already pending.
+        A lone ESC is dispatched once no further bytes follow within a short timeout.
+        Returns the number of bytes read, 0 if the wait timed out or was interrupted by a signal
+        and -1 on end of input. */
+        int update(int timeout = -1);
     };
-}
\ No newline at end of file
+}
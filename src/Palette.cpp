@@ -0,0 +1,309 @@
+#include "Palette.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace Palette;
+
+namespace {
+
+    const char Magic[8] = {'C', 'L', 'I', 'D', 'P', 'A', 'L', '\0'};
+    constexpr uint32_t Version = 2;
+
+    bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    std::string_view Trim(std::string_view s) {
+        while (!s.empty() && IsSpace(s.front())) s.remove_prefix(1);
+        while (!s.empty() && IsSpace(s.back())) s.remove_suffix(1);
+        return s;
+    }
+
+    /** Cut the first whitespace separated token off s. */
+    std::string_view NextToken(std::string_view& s) {
+        s = Trim(s);
+        size_t end = 0;
+        while (end < s.size() && !IsSpace(s[end])) ++end;
+        std::string_view token = s.substr(0, end);
+        s.remove_prefix(end);
+        return token;
+    }
+
+    /** Parse "R G B" off the front of s. */
+    bool ParseDecimal(std::string_view& s, Color::RGB& rgb) {
+        uint8_t* channels[3] = {&rgb.r, &rgb.g, &rgb.b};
+        for (uint8_t* channel : channels) {
+            std::string_view token = NextToken(s);
+            unsigned value;
+            auto [end, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+            if (ec != std::errc() || end != token.data() + token.size() || value > 255) return false;
+            *channel = static_cast<uint8_t>(value);
+        }
+        return true;
+    }
+
+    /** Parse "R G B name" or "#RRGGBB name". Decimal comes first, "255 0 0" would also pass as short hex. */
+    bool ParseLine(std::string_view line, Color::RGB& rgb, std::string_view& name) {
+        std::string_view rest = line;
+        if (!ParseDecimal(rest, rgb)) {
+            rest = line;
+            if (!Color::DecodeHEX(rgb, NextToken(rest))) return false;
+        }
+
+        name = Trim(rest);
+        return !name.empty();
+    }
+
+    float Distance(const float* a, const float* b) {
+        float dL = a[0] - b[0], da = a[1] - b[1], db = a[2] - b[2];
+        return dL * dL + da * da + db * db;
+    }
+
+    /** Order nodes[first, last) into an implicit k-d tree. */
+    void BuildTree(Index::Node* nodes, size_t first, size_t last, size_t depth) {
+        if (last - first <= 1) return;
+        size_t mid = first + (last - first) / 2;
+        size_t axis = depth % 3;
+        std::nth_element(nodes + first, nodes + mid, nodes + last,
+            [axis](const Index::Node& a, const Index::Node& b) { return a.lab[axis] < b.lab[axis]; });
+        BuildTree(nodes, first, mid, depth + 1);
+        BuildTree(nodes, mid + 1, last, depth + 1);
+    }
+
+    /** $XDG_CACHE_HOME/clid or ~/.cache/clid, created if missing. Empty if there is none. */
+    std::string CacheDirectory() {
+        std::string base;
+        if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) base = xdg;
+        else if (const char* home = std::getenv("HOME"); home && *home) base = std::string(home) + "/.cache";
+        else return "";
+
+        if (mkdir(base.c_str(), 0755) != 0 && errno != EEXIST) return "";
+        std::string dir = base + "/clid";
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return "";
+        return dir;
+    }
+
+    /** Cache file of a palette, named after a hash of its absolute path. */
+    std::string CachePath(const std::string& palettePath) {
+        std::string dir = CacheDirectory();
+        if (dir.empty()) return "";
+
+        char* resolved = realpath(palettePath.c_str(), nullptr);
+        std::string absolute = resolved ? resolved : palettePath;
+        free(resolved);
+
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : absolute) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.idx", static_cast<unsigned long long>(hash));
+        return dir + name;
+    }
+
+    /** Write a file under a temporary name and move it into place, so readers never see half of it. */
+    bool WriteFileAtomic(const std::string& path, const std::vector<char>& data) {
+        std::string temp = path + ".tmp" + std::to_string(getpid());
+        {
+            std::ofstream out(temp, std::ios::binary);
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+            if (!out) {
+                unlink(temp.c_str());
+                return false;
+            }
+        }
+        if (rename(temp.c_str(), path.c_str()) != 0) {
+            unlink(temp.c_str());
+            return false;
+        }
+        return true;
+    }
+}
+
+Index::~Index() {
+    if (mapping) munmap(mapping, mappingSize);
+}
+
+void Index::Attach(const char* data) {
+    header = reinterpret_cast<const Header*>(data);
+    nodes = reinterpret_cast<const Node*>(data + sizeof(Header));
+    names = data + sizeof(Header) + header->count * sizeof(Node);
+}
+
+bool Index::Map(const std::string& cachePath, uint64_t sourceSize, int64_t sourceMtime) {
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(Header)) {
+        data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    // Only use the cache if it was built from this version of the palette and is complete
+    const Header* cached = static_cast<const Header*>(data);
+    size_t size = static_cast<size_t>(info.st_size);
+    if (memcmp(cached->magic, Magic, sizeof(Magic)) != 0 || cached->version != Version ||
+        cached->sourceSize != sourceSize || cached->sourceMtime != sourceMtime ||
+        cached->count > (size - sizeof(Header)) / sizeof(Node) ||
+        cached->namesSize != size - sizeof(Header) - cached->count * sizeof(Node)) {
+        munmap(data, size);
+        return false;
+    }
+
+    // A damaged cache must not point names outside the file, it is rebuilt instead
+    const Node* cachedNodes = reinterpret_cast<const Node*>(static_cast<const char*>(data) + sizeof(Header));
+    for (uint32_t i = 0; i < cached->count; i++) {
+        if (uint64_t(cachedNodes[i].nameOffset) + cachedNodes[i].nameSize > cached->namesSize) {
+            munmap(data, size);
+            return false;
+        }
+    }
+
+    mapping = data;
+    mappingSize = size;
+    Attach(static_cast<const char*>(data));
+    return true;
+}
+
+bool Palette::Read(const std::string& palettePath, std::vector<Entry>& out) {
+    std::ifstream file(palettePath, std::ios::binary);
+    if (!file) return false;
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    out.clear();
+    size_t invalid = 0;
+    std::string_view rest = text;
+    while (!rest.empty()) {
+        size_t end = rest.find('\n');
+        std::string_view line = Trim(rest.substr(0, end));
+        rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+        if (line.empty() || line[0] == '!') continue;
+
+        Entry entry{};
+        std::string_view name;
+        if (!ParseLine(line, entry.rgb, name)) {
+            ++invalid;
+            continue;
+        }
+        entry.name = name;
+        out.push_back(std::move(entry));
+    }
+    if (invalid > 0) std::cerr << invalid << " invalid line(s) in '" << palettePath << "' were skipped.\n";
+    return true;
+}
+
+bool Index::Build(const std::string& palettePath, uint64_t sourceSize, int64_t sourceMtime) {
+    std::vector<Entry> entries;
+    if (!Read(palettePath, entries)) return false;
+
+    std::vector<Node> parsed(entries.size());
+    std::string nameTable;
+    for (size_t i = 0; i < entries.size(); i++) {
+        Node& node = parsed[i];
+        node.rgb = entries[i].rgb;
+
+        Color::OKLab lab;
+        Color::RGBtoOKLab(lab, node.rgb);
+        node.lab[0] = lab.L;
+        node.lab[1] = lab.a;
+        node.lab[2] = lab.b;
+        node.nameOffset = static_cast<uint32_t>(nameTable.size());
+        node.nameSize = static_cast<uint32_t>(entries[i].name.size());
+        nameTable += entries[i].name;
+    }
+
+    BuildTree(parsed.data(), 0, parsed.size(), 0);
+
+    Header built{};
+    memcpy(built.magic, Magic, sizeof(Magic));
+    built.version = Version;
+    built.count = static_cast<uint32_t>(parsed.size());
+    built.sourceSize = sourceSize;
+    built.sourceMtime = sourceMtime;
+    built.namesSize = nameTable.size();
+
+    owned.resize(sizeof(Header) + parsed.size() * sizeof(Node) + nameTable.size());
+    memcpy(owned.data(), &built, sizeof(Header));
+    memcpy(owned.data() + sizeof(Header), parsed.data(), parsed.size() * sizeof(Node));
+    memcpy(owned.data() + sizeof(Header) + parsed.size() * sizeof(Node), nameTable.data(), nameTable.size());
+    Attach(owned.data());
+    return true;
+}
+
+bool Index::Load(const std::string& palettePath) {
+    struct stat info;
+    if (stat(palettePath.c_str(), &info) != 0) {
+        std::cerr << "Could not open '" << palettePath << "'!\n";
+        return false;
+    }
+    uint64_t sourceSize = static_cast<uint64_t>(info.st_size);
+    int64_t sourceMtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+
+    std::string cachePath = CachePath(palettePath);
+    if (!cachePath.empty() && Map(cachePath, sourceSize, sourceMtime)) return true;
+
+    if (!Build(palettePath, sourceSize, sourceMtime)) {
+        std::cerr << "Could not read '" << palettePath << "'!\n";
+        return false;
+    }
+
+    // A palette that can not be cached still works, it is just indexed again next time
+    if (!cachePath.empty()) WriteFileAtomic(cachePath, owned);
+    return true;
+}
+
+void Index::Search(const float* lab, size_t first, size_t last, size_t depth, size_t& best, float& bestDistance) const {
+    if (first >= last) return;
+    size_t mid = first + (last - first) / 2;
+    const Node& node = nodes[mid];
+
+    float distance = Distance(lab, node.lab);
+    if (distance < bestDistance) {
+        bestDistance = distance;
+        best = mid;
+    }
+
+    // Search the side the point is on first, the other one only if the splitting plane is closer than the best match
+    size_t axis = depth % 3;
+    float delta = lab[axis] - node.lab[axis];
+    if (delta < 0) {
+        Search(lab, first, mid, depth + 1, best, bestDistance);
+        if (delta * delta < bestDistance) Search(lab, mid + 1, last, depth + 1, best, bestDistance);
+    } else {
+        Search(lab, mid + 1, last, depth + 1, best, bestDistance);
+        if (delta * delta < bestDistance) Search(lab, first, mid, depth + 1, best, bestDistance);
+    }
+}
+
+bool Index::Nearest(const Color::RGB& color, Match& out) const {
+    if (Size() == 0) return false;
+
+    Color::OKLab lab;
+    Color::RGBtoOKLab(lab, color);
+    float point[3] = {lab.L, lab.a, lab.b};
+
+    size_t best = 0;
+    float bestDistance = Distance(point, nodes[0].lab);
+    Search(point, 0, header->count, 0, best, bestDistance);
+
+    const Node& node = nodes[best];
+    out = {std::string_view(names + node.nameOffset, node.nameSize), node.rgb, std::sqrt(bestDistance)};
+    return true;
+}
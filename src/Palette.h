@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Color.h"
+
+namespace Palette {
+
+    /** A palette color found by a nearest color query. */
+    struct Match {
+        std::string_view name;
+        Color::RGB rgb;
+        float distance;     // Euclidean distance in OKLab
+    };
+
+    /** A color of a palette file and its name. */
+    struct Entry {
+        Color::RGB rgb;
+        std::string name;
+    };
+
+    /** Read the colors of a palette file in file order (the format Index::Load takes). Invalid lines are skipped
+    with a warning. Returns false if the file can not be read. */
+    bool Read(const std::string& palettePath, std::vector<Entry>& out);
+
+    /** Nearest named color lookup over a palette file.
+    The colors are stored as an implicit k-d tree over OKLab: the middle element of every range splits it
+    on the axis of its depth, so the tree is a flat array without pointers. Header, tree and names are kept
+    in one block with the same layout in memory and on disk, which lets a cached index be mapped as is. */
+    class Index {
+    public:
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t count;
+            uint64_t sourceSize;    // Size and modification time of the palette file the index was built from
+            int64_t sourceMtime;
+            uint64_t namesSize;
+        };
+
+        struct Node {
+            float lab[3];
+            Color::RGB rgb;
+            uint8_t padding;
+            uint32_t nameOffset;
+            uint32_t nameSize;
+        };
+    private:
+        std::vector<char> owned;        // Index built in memory
+        void* mapping = nullptr;        // or a cached index mapped from disk
+        size_t mappingSize = 0;
+
+        const Header* header = nullptr;
+        const Node* nodes = nullptr;
+        const char* names = nullptr;
+
+        void Attach(const char* data);
+        bool Map(const std::string& cachePath, uint64_t sourceSize, int64_t sourceMtime);
+        bool Build(const std::string& palettePath, uint64_t sourceSize, int64_t sourceMtime);
+        void Search(const float* lab, size_t first, size_t last, size_t depth, size_t& best, float& bestDistance) const;
+    public:
+        Index() = default;
+        ~Index();
+
+        Index(const Index&) = delete;
+        Index& operator=(const Index&) = delete;
+
+        /** Load the index of a palette file. Every line holds a color ("#RRGGBB" or the X11 rgb.txt form "R G B")
+        followed by its name, lines starting with '!' are comments. A cached index is used when it is up to date,
+        otherwise the palette is indexed and the cache is rewritten. Returns false if the palette can not be read. */
+        bool Load(const std::string& palettePath);
+
+        /** True if the index came from the disk cache. */
+        bool IsMapped() const { return mapping != nullptr; }
+
+        size_t Size() const { return header ? header->count : 0; }
+
+        /** Find the palette color nearest to a color. Returns false if the palette is empty. */
+        bool Nearest(const Color::RGB& color, Match& out) const;
+    };
+}
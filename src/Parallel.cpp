@@ -0,0 +1,90 @@
+#include "Parallel.h"
+#include <algorithm>
+
+using namespace Parallel;
+
+namespace {
+    constexpr size_t MinBandCells = 4096;   // Below this a band costs less than waking a worker
+    constexpr size_t MaxThreads = 16;
+
+    size_t requestedThreads = 0;
+}
+
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 1; i < threads; i++) workers.emplace_back(&ThreadPool::Work, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::RunTasks(const std::function<void(size_t)>& task, size_t count) {
+    for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) task(i);
+}
+
+void ThreadPool::Work() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+
+        // The job may already be finished if this worker woke up late
+        if (!job) continue;
+        const std::function<void(size_t)>& task = *job;
+        size_t count = jobSize;
+        ++running;
+
+        lock.unlock();
+        RunTasks(task, count);
+        lock.lock();
+
+        if (--running == 0) done.notify_one();
+    }
+}
+
+void ThreadPool::Run(size_t count, const std::function<void(size_t)>& task) {
+    std::unique_lock<std::mutex> busy(jobMutex, std::try_to_lock);
+    if (!busy || workers.empty() || count <= 1) {
+        for (size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        jobSize = count;
+        next = 0;
+        ++generation;
+    }
+    wake.notify_all();
+
+    RunTasks(task, count);
+
+    // Every task has been handed out, wait for the workers still running one
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return running == 0; });
+    job = nullptr;
+}
+
+void Parallel::SetThreads(size_t threads) {
+    requestedThreads = threads;
+}
+
+ThreadPool& Parallel::Pool() {
+    // Never destroyed: the map cache worker may still be generating while static objects are torn down
+    static ThreadPool* pool = new ThreadPool(std::min(MaxThreads,
+        requestedThreads ? requestedThreads : std::max<size_t>(1, std::thread::hardware_concurrency())));
+    return *pool;
+}
+
+size_t Parallel::Bands(size_t rows, size_t cells) {
+    size_t bands = std::min({Pool().Threads(), rows, cells / MinBandCells});
+    return std::max<size_t>(1, bands);
+}
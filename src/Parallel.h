@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+    /** Persistent worker threads that run the tasks of one job at a time. The calling thread works on the job too.
+    A caller that finds the pool busy with another job runs its tasks itself instead of waiting. */
+    class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::mutex jobMutex;                // Held by the caller whose job is running
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        const std::function<void(size_t)>* job = nullptr;
+        size_t jobSize = 0;
+        std::atomic<size_t> next{0};        // Next task index to hand out
+        size_t running = 0;                 // Workers currently inside the job
+        uint64_t generation = 0;
+        bool stopping = false;
+
+        void Work();
+        void RunTasks(const std::function<void(size_t)>& task, size_t count);
+    public:
+        /** Pool with `threads` threads in total, including the caller. */
+        explicit ThreadPool(size_t threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /** Threads that work on a job, including the caller. */
+        size_t Threads() const { return workers.size() + 1; }
+
+        /** Call task(i) for every i < count spread over the pool. Returns once all calls finished. */
+        void Run(size_t count, const std::function<void(size_t)>& task);
+    };
+
+    /** Set how many threads Pool() uses (0 for one per core). Only has an effect before Pool() is first used. */
+    void SetThreads(size_t threads);
+
+    /** The pool shared by map generation and encoding. */
+    ThreadPool& Pool();
+
+    /** Number of row bands to split work over `rows` rows and `cells` cells into.
+    Returns 1 when the work is too small for the pool to pay off. */
+    size_t Bands(size_t rows, size_t cells);
+}
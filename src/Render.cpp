@@ -1,4 +1,5 @@
 #include "Render.h"
+#include "Parallel.h"
 #include <string>
 #include <fstream>
 #include <iostream>
@@ -6,83 +7,718 @@
 #include <sstream>
 #include <cmath>
 #include <algorithm>
-#include <tuple> 
+#include <tuple>
+#include <cstring>
+#include <span>
+#include <array>
 
 using namespace Render;
 using namespace std;
 
-void Render::CalcSize(RenderBuffer& rb) {
-    rb.height = rb.pixelMatrix.size();
-    rb.width = rb.height > 0 ? rb.pixelMatrix[0].size() : 0;
+bool Render::operator==(const Cell& a, const Cell& b) {
+    if (a.glyphSize != b.glyphSize || a.flags != b.flags) return false;
+    if (memcmp(a.glyph, b.glyph, a.glyphSize) != 0) return false;
+    if ((a.flags & HasFg) && a.fg != b.fg) return false;
+    if ((a.flags & HasBg) && a.bg != b.bg) return false;
+    return true;
+}
+
+RenderView Render::View(RenderBuffer& rb) {
+    return {rb.pixels.data(), rb.width, rb.height, rb.width, rb.mode};
+}
+
+RenderView Render::View(RenderBuffer& rb, size_t x, size_t y, size_t width, size_t height) {
+    x = min(x, rb.width);
+    y = min(y, rb.height);
+    width = min(width, rb.width - x);
+    height = min(height, rb.height - y);
+    return {rb.pixels.data() + y * rb.width + x, width, height, rb.width, rb.mode};
 }
 
 void Render::Fill(RenderBuffer& rb, const Pixel pixel) {
-    vector<Pixel> line;
-    for (size_t w = 0; w < rb.width; w++) line.push_back(pixel);
-    for (size_t h = 0; h < rb.height; h++) rb.pixelMatrix.push_back(line);
+    rb.pixels.assign(rb.width * rb.height, pixel);
 }
 
-bool Render::GenerateShadeMap(RenderBuffer& rb, float hue) {
-    if (rb.width == 0 || rb.height == 0) return false;
+void Render::Fill(const RenderView& view, const Pixel pixel) {
+    for (size_t y = 0; y < view.height; y++) {
+        Pixel* row = view.data + y * view.stride;
+        std::fill(row, row + view.width, pixel);
+    }
+}
 
-    rb.pixelMatrix.resize(rb.height, vector<Pixel>(rb.width));
+namespace {
+    /** Where index i lies between the first (0) and last (1) of size positions. A map that is one pixel wide
+    or high only has its first position: saturation or chroma 0 and full lightness. */
+    float Position(size_t i, size_t size) {
+        return size > 1 ? static_cast<float>(i) / (size - 1) : 0.0f;
+    }
+
+    /** OKLCH color at (x, y) of a shade map: lightness falls from top to bottom, chroma rises from gray on the
+    left to maxChroma, the most the row's lightness allows for this hue. */
+    Color::OKLCH ShadeOKLCH(size_t width, size_t x, float lightness, float maxChroma, float hue) {
+        float chroma = Position(x, width) * maxChroma;
+        return {lightness, chroma, hue * 360.0f};
+    }
 
-    for (size_t y = 0; y < rb.height; ++y) {
-        for (size_t x = 0; x < rb.width; ++x) {
-            float saturation = static_cast<float>(x) / (rb.width - 1);
-            float lightness = 1.0f - static_cast<float>(y) / (rb.height - 1);
-            Color::RGB rgb;
-            Color::HSLtoRGB(rgb, {hue, saturation, lightness});
-            rb.pixelMatrix[y][x] = rgb;
+    /** The region of a shade map that rb holds. */
+    struct ShadeRegion {
+        size_t mapWidth;
+        size_t mapHeight;
+        size_t left;
+        size_t top;
+    };
+
+    void GenerateShadeRows(RenderBuffer& rb, float hue, ShadeModel model, const ShadeRegion& region,
+                           size_t first, size_t last) {
+        // Build one row of color values at a time and convert it with the batch conversions
+        if (model == ShadeModel::OKLCH) {
+            vector<Color::OKLCH> row(rb.width);
+            for (size_t y = first; y < last; ++y) {
+                float lightness = 1.0f - Position(region.top + y, region.mapHeight);
+                float maxChroma = Color::MaxChroma(lightness, hue * 360.0f);
+                for (size_t x = 0; x < rb.width; ++x) {
+                    row[x] = ShadeOKLCH(region.mapWidth, region.left + x, lightness, maxChroma, hue);
+                }
+                Color::OKLCHtoRGB(std::span(rb.pixels.data() + y * rb.width, rb.width), row);
+            }
+            return;
+        }
+
+        vector<Color::HSL> row(rb.width);
+        for (size_t y = first; y < last; ++y) {
+            float lightness = 1.0f - Position(region.top + y, region.mapHeight);
+            for (size_t x = 0; x < rb.width; ++x) {
+                float saturation = Position(region.left + x, region.mapWidth);
+                row[x] = {hue, saturation, lightness};
+            }
+            Color::HSLtoRGB(std::span(rb.pixels.data() + y * rb.width, rb.width), row);
         }
     }
+}
+
+bool Render::GenerateShadeMap(RenderBuffer& rb, float hue, ShadeModel model) {
+    return GenerateShadeRegion(rb, hue, rb.width, rb.height, 0, 0, model);
+}
+
+bool Render::GenerateShadeRegion(RenderBuffer& rb, float hue, size_t mapWidth, size_t mapHeight, size_t x, size_t y,
+                                 ShadeModel model) {
+    if (rb.width == 0 || rb.height == 0) return false;
+    if (x + rb.width > mapWidth || y + rb.height > mapHeight) return false;
+
+    rb.pixels.resize(rb.width * rb.height);
+
+    // Large maps are split into row bands that are generated in parallel
+    ShadeRegion region{mapWidth, mapHeight, x, y};
+    size_t bands = Parallel::Bands(rb.height, rb.pixels.size());
+    Parallel::Pool().Run(bands, [&](size_t band) {
+        GenerateShadeRows(rb, hue, model, region, band * rb.height / bands, (band + 1) * rb.height / bands);
+    });
 
     return true;
 }
 
-bool Render::GenerateHueMap(RenderBuffer& rb) {
+bool Render::GenerateHueMap(RenderBuffer& rb, ShadeModel model) {
     if (rb.width == 0 || rb.height == 0) return false;
 
-    rb.pixelMatrix.resize(rb.height, vector<Pixel>(rb.width));
+    rb.pixels.resize(rb.width * rb.height);
 
     const float increments = 1.0f / rb.height;
 
     float hue = 0.0f;
     for (size_t y = 0; y < rb.height; ++y, hue += increments) {
         Color::RGB hue_rgb;
-        Color::HSLtoRGB(hue_rgb, {hue, 1.f, 0.5f}); // l=0.5 for vivid hue
-        for (size_t x = 0; x < rb.width; ++x) {
-            rb.pixelMatrix[y][x] = hue_rgb;
+        if (model == ShadeModel::OKLCH) {
+            // Same lightness and chroma for every hue, as far as sRGB allows, so no hue stands out
+            float chroma = std::min(0.13f, Color::MaxChroma(0.7f, hue * 360.0f));
+            Color::OKLCHtoRGB(hue_rgb, {0.7f, chroma, hue * 360.0f});
+        } else {
+            Color::HSLtoRGB(hue_rgb, {hue, 1.f, 0.5f}); // l=0.5 for vivid hue
         }
+        std::fill_n(rb.pixels.data() + y * rb.width, rb.width, hue_rgb);
     }
 
     return true;
 }
 
-void Render::RenderANSIString(string& buffer, RenderBuffer& rb) {
-    size_t line = 0;
-    while (line < rb.height) {
-        for (size_t col = 0; col < rb.width; col++) {
-            Pixel pixel = rb.pixelMatrix[line][col];
-            if (line + 1 < rb.height) {
-                Pixel pixelNextLine = rb.pixelMatrix[line + 1][col];
-                if (pixel.r == pixelNextLine.r && pixel.g == pixelNextLine.g && pixel.b == pixelNextLine.b) {
-                    buffer += Color::RGBtoANSI(pixel, true) + "█\033[0m";
+void Render::Clear(CellGrid& grid, size_t width, size_t height) {
+    grid.width = width;
+    grid.height = height;
+    grid.cells.assign(width * height, Cell{{' '}, 1, 0, {}, {}});
+}
+
+namespace {
+
+    /** A glyph as UTF-8. */
+    struct Glyph {
+        char bytes[4];
+        uint8_t size;
+    };
+
+    constexpr Glyph Encode(uint32_t code) {
+        Glyph glyph{};
+        if (code < 0x80) {
+            glyph.bytes[0] = static_cast<char>(code);
+            glyph.size = 1;
+        } else if (code < 0x10000) {
+            glyph.bytes[0] = static_cast<char>(0xE0 | code >> 12);
+            glyph.bytes[1] = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+            glyph.bytes[2] = static_cast<char>(0x80 | (code & 0x3F));
+            glyph.size = 3;
+        } else {
+            glyph.bytes[0] = static_cast<char>(0xF0 | code >> 18);
+            glyph.bytes[1] = static_cast<char>(0x80 | (code >> 12 & 0x3F));
+            glyph.bytes[2] = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+            glyph.bytes[3] = static_cast<char>(0x80 | (code & 0x3F));
+            glyph.size = 4;
+        }
+        return glyph;
+    }
+
+    // Glyphs by the mask of pixels drawn in the foreground color, bit (y * 2 + x) for the pixel at (x, y)
+    constexpr auto QuadrantGlyphs = [] {
+        constexpr uint32_t codes[16] = {
+            ' ', 0x2598, 0x259D, 0x2580, 0x2596, 0x258C, 0x259E, 0x259B,
+            0x2597, 0x259A, 0x2590, 0x259C, 0x2584, 0x2599, 0x259F, 0x2588,
+        };
+        std::array<Glyph, 16> table{};
+        for (size_t i = 0; i < 16; i++) table[i] = Encode(codes[i]);
+        return table;
+    }();
+
+    constexpr auto SextantGlyphs = [] {
+        // U+1FB00 onwards holds every sextant except the ones that already exist as half and full blocks
+        std::array<Glyph, 64> table{};
+        for (uint32_t mask = 0; mask < 64; mask++) {
+            uint32_t code = 0x1FB00 + mask - 1 - (mask > 21) - (mask > 42);
+            if (mask == 0) code = ' ';
+            else if (mask == 21) code = 0x258C;
+            else if (mask == 42) code = 0x2590;
+            else if (mask == 63) code = 0x2588;
+            table[mask] = Encode(code);
+        }
+        return table;
+    }();
+
+    constexpr auto BrailleGlyphs = [] {
+        // Braille numbers its dots down the left column, then the right one, with the bottom row last
+        constexpr uint8_t dots[8] = {0x01, 0x08, 0x02, 0x10, 0x04, 0x20, 0x40, 0x80};
+        std::array<Glyph, 256> table{};
+        for (uint32_t mask = 0; mask < 256; mask++) {
+            uint32_t pattern = 0;
+            for (size_t bit = 0; bit < 8; bit++) {
+                if (mask & (1u << bit)) pattern |= dots[bit];
+            }
+            table[mask] = Encode(0x2800 + pattern);
+        }
+        return table;
+    }();
+
+    const Glyph& MaskGlyph(PixelMode mode, uint32_t mask) {
+        switch (mode) {
+            case PixelMode::Quadrant: return QuadrantGlyphs[mask];
+            case PixelMode::Sextant: return SextantGlyphs[mask];
+            default: return BrailleGlyphs[mask];
+        }
+    }
+
+    /** Average of the pixels whose bit is set in mask. */
+    Pixel Mean(const Pixel* pixels, size_t count, uint32_t mask) {
+        unsigned r = 0, g = 0, b = 0, n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!(mask & (1u << i))) continue;
+            r += pixels[i].r;
+            g += pixels[i].g;
+            b += pixels[i].b;
+            n++;
+        }
+        return {static_cast<uint8_t>((r + n / 2) / n), static_cast<uint8_t>((g + n / 2) / n),
+                static_cast<uint8_t>((b + n / 2) / n)};
+    }
+
+    int Distance(const Pixel& a, const Pixel& b) {
+        int dr = a.r - b.r, dg = a.g - b.g, db = a.b - b.b;
+        return dr * dr + dg * dg + db * db;
+    }
+
+    /** Split of a full cell into the two groups with the lowest squared error to their means, as the mask of the
+    first group. Tries every split, 7 for quadrants and 31 for sextants: the last pixel always stays in the
+    second group and the splits are walked in gray code order, so each one moves a single pixel.
+    The error of a group is the sum of its squared pixels minus |sum|^2 / n, so the best split is the one with
+    the largest |sum1|^2 / n1 + |sum2|^2 / n2. */
+    uint32_t BestSplit(const Pixel* pixels, size_t count) {
+        int64_t total[3] = {0, 0, 0};
+        for (size_t i = 0; i < count; i++) {
+            total[0] += pixels[i].r;
+            total[1] += pixels[i].g;
+            total[2] += pixels[i].b;
+        }
+
+        int64_t sum[3] = {0, 0, 0};
+        int64_t n = 0;
+        uint32_t mask = 0, best = 1;
+        int64_t bestScore = -1, bestDivisor = 1;
+        for (uint32_t step = 1; step < (1u << (count - 1)); step++) {
+            uint32_t bit = static_cast<uint32_t>(__builtin_ctz(step));
+            int64_t sign = (mask & (1u << bit)) ? -1 : 1;
+            mask ^= 1u << bit;
+            sum[0] += sign * pixels[bit].r;
+            sum[1] += sign * pixels[bit].g;
+            sum[2] += sign * pixels[bit].b;
+            n += sign;
+
+            int64_t first = 0, second = 0;
+            for (int c = 0; c < 3; c++) {
+                first += sum[c] * sum[c];
+                second += (total[c] - sum[c]) * (total[c] - sum[c]);
+            }
+            int64_t rest = static_cast<int64_t>(count) - n;
+            int64_t score = first * rest + second * n, divisor = n * rest;
+            if (score * bestDivisor > bestScore * divisor) {
+                bestScore = score;
+                bestDivisor = divisor;
+                best = mask;
+            }
+        }
+        return best;
+    }
+
+    /** Split of a full braille cell, where trying all 127 splits costs too much. The two pixels furthest apart
+    seed two groups and every other pixel joins the nearer one, then every pixel moves to the nearer group mean
+    once. */
+    uint32_t SeededSplit(const Pixel* pixels, size_t count) {
+        size_t first = 0, second = 1;
+        int spread = -1;
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = i + 1; j < count; j++) {
+                int distance = Distance(pixels[i], pixels[j]);
+                if (distance > spread) {
+                    spread = distance;
+                    first = i;
+                    second = j;
+                }
+            }
+        }
+
+        uint32_t mask = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (Distance(pixels[i], pixels[second]) < Distance(pixels[i], pixels[first])) mask |= 1u << i;
+        }
+
+        Pixel inside = Mean(pixels, count, mask), outside = Mean(pixels, count, ~mask);
+        uint32_t reassigned = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (Distance(pixels[i], inside) < Distance(pixels[i], outside)) reassigned |= 1u << i;
+        }
+        return reassigned != 0 && reassigned != (1u << count) - 1 ? reassigned : mask;
+    }
+
+    /** Pack one cell of a Quadrant, Sextant or Braille view. The pixels are split into the two groups that
+    stay closest to their average colors, and each group is drawn in its average. */
+    void PackCell(Cell& cell, const RenderView& view, size_t left, size_t top) {
+        static const Glyph fullBlock = Encode(0x2588);
+
+        size_t cellWidth = CellWidth(view.mode), cellHeight = CellHeight(view.mode);
+        Pixel pixels[8];
+        uint32_t present = 0;
+        bool uniform = true;
+        size_t count = cellWidth * cellHeight;
+        for (size_t i = 0; i < count; i++) {
+            size_t x = left + i % cellWidth, y = top + i / cellWidth;
+            if (x < view.width && y < view.height) {
+                pixels[i] = At(view, x, y);
+                present |= 1u << i;
+                uniform = uniform && pixels[i] == pixels[0];
+            }
+        }
+
+        cell.flags = HasFg;
+        const Glyph* glyph;
+        if (present != (1u << count) - 1) {
+            // Past the edge of the view the terminal background has to show, which leaves one color
+            cell.fg = Mean(pixels, count, present);
+            glyph = &MaskGlyph(view.mode, present);
+        } else if (uniform) {
+            cell.fg = pixels[0];
+            glyph = &fullBlock;
+        } else {
+            uint32_t mask = count <= 6 ? BestSplit(pixels, count) : SeededSplit(pixels, count);
+            cell.fg = Mean(pixels, count, mask);
+            cell.bg = Mean(pixels, count, ~mask);
+            cell.flags |= HasBg;
+            glyph = &MaskGlyph(view.mode, mask);
+        }
+        memcpy(cell.glyph, glyph->bytes, glyph->size);
+        cell.glyphSize = glyph->size;
+    }
+}
+
+void Render::BlitPixels(CellGrid& grid, const RenderView& view, size_t col, size_t row) {
+    if (view.mode != PixelMode::Half) {
+        size_t cellWidth = CellWidth(view.mode), cellHeight = CellHeight(view.mode);
+        for (size_t top = 0; top < view.height && row < grid.height; top += cellHeight, row++) {
+            for (size_t left = 0, x = col; left < view.width && x < grid.width; left += cellWidth, x++) {
+                PackCell(At(grid, x, row), view, left, top);
+            }
+        }
+        return;
+    }
+
+    static const char upperHalf[] = "▀";
+    static const char fullBlock[] = "█";
+
+    for (size_t line = 0; line < view.height && row < grid.height; line += 2, row++) {
+        for (size_t x = 0; x < view.width && col + x < grid.width; x++) {
+            Cell& cell = At(grid, col + x, row);
+            Pixel pixel = At(view, x, line);
+            cell.fg = pixel;
+            cell.flags = HasFg;
+            cell.glyphSize = 3;
+
+            if (line + 1 < view.height) {
+                Pixel pixelNextLine = At(view, x, line + 1);
+                if (pixel == pixelNextLine) {
+                    memcpy(cell.glyph, fullBlock, 3);
                 } else {
-                    buffer += Color::RGBtoANSI(pixel, true) + Color::RGBtoANSI(pixelNextLine, false) + "▀\033[0m";
+                    memcpy(cell.glyph, upperHalf, 3);
+                    cell.bg = pixelNextLine;
+                    cell.flags |= HasBg;
                 }
             } else {
-                buffer += Color::RGBtoANSI(pixel, true) + "▀\033[0m";
+                memcpy(cell.glyph, upperHalf, 3);
             }
         }
-        buffer += "\n";
-        line += 2;
     }
 }
 
-Render::Pixel Render::GetShadeColor(size_t width, size_t height, float hue, size_t x, size_t y) {
-    float lightness = 1.0f - (float)y / (height - 1); // top is bright, bottom is dark
-    float saturation = (float)x / (width - 1);        // left is gray, right is full color
+void Render::BlitCells(CellGrid& grid, const CellGrid& cells, size_t col, size_t row) {
+    if (col >= grid.width) return;
+    size_t width = min(cells.width, grid.width - col);
+
+    for (size_t y = 0; y < cells.height && row + y < grid.height; y++) {
+        const Cell* src = &At(cells, 0, y);
+        std::copy(src, src + width, &At(grid, col, row + y));
+    }
+}
+
+namespace {
+    void BlitTextCells(CellGrid& grid, std::string_view text, size_t col, size_t row, const Pixel* fg) {
+        size_t x = col;
+        for (size_t i = 0; i < text.size() && row < grid.height;) {
+            unsigned char lead = static_cast<unsigned char>(text[i]);
+            if (lead == '\n') {
+                x = col;
+                ++row;
+                ++i;
+                continue;
+            }
+
+            // Length of the UTF-8 sequence from its lead byte
+            size_t size = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+            size = min(size, text.size() - i);
+
+            if (x < grid.width) {
+                Cell& cell = At(grid, x, row);
+                memcpy(cell.glyph, text.data() + i, size);
+                cell.glyphSize = static_cast<uint8_t>(size);
+                cell.flags = 0;
+                if (fg) {
+                    cell.fg = *fg;
+                    cell.flags = HasFg;
+                }
+            }
+            ++x;
+            i += size;
+        }
+    }
+}
+
+void Render::BlitText(CellGrid& grid, std::string_view text, size_t col, size_t row) {
+    BlitTextCells(grid, text, col, row, nullptr);
+}
+
+void Render::BlitText(CellGrid& grid, std::string_view text, size_t col, size_t row, const Pixel fg) {
+    BlitTextCells(grid, text, col, row, &fg);
+}
+
+namespace {
+    constexpr size_t MaxDiffGap = 6;     // Unchanged cells rewritten instead of moving the cursor over them
+    constexpr size_t MaxCellBytes = 42;  // "\033[38;2;255;255;255;48;2;255;255;255m" plus a 4 byte glyph
+
+    Color::Mode colorMode = Color::Mode::TrueColor;
+
+    /** Decimal text of every byte value, so color components are not formatted one digit at a time. */
+    struct DecimalTable {
+        char text[256][4];
+        uint8_t size[256];
+    };
+
+    constexpr DecimalTable Decimals = [] {
+        DecimalTable table{};
+        for (int i = 0; i < 256; i++) {
+            int n = 0;
+            if (i >= 100) table.text[i][n++] = static_cast<char>('0' + i / 100);
+            if (i >= 10) table.text[i][n++] = static_cast<char>('0' + i / 10 % 10);
+            table.text[i][n++] = static_cast<char>('0' + i % 10);
+            table.size[i] = static_cast<uint8_t>(n);
+        }
+        return table;
+    }();
+
+    /** Colors the terminal currently has set, so unchanged colors and resets are not sent again.
+    Colors are kept as ColorKey values, pixels that map to the same palette index count as unchanged. */
+    struct SGRState {
+        uint8_t flags = 0;
+        uint32_t fg = 0;
+        uint32_t bg = 0;
+    };
+
+    /** A color as the terminal sees it: the packed RGB value in truecolor mode, the palette index otherwise. */
+    uint32_t ColorKey(const Pixel& pixel) {
+        switch (colorMode) {
+            case Color::Mode::Indexed256: return Color::RGBto256(pixel);
+            case Color::Mode::Indexed16: return Color::RGBto16(pixel);
+            case Color::Mode::TrueColor: break;
+        }
+        return (uint32_t(pixel.r) << 16) | (uint32_t(pixel.g) << 8) | pixel.b;
+    }
+
+    /** Output that only adds up how many bytes would be written, so band sizes are known before encoding. */
+    struct ByteCounter {
+        size_t size = 0;
+
+        void append(const char*, size_t count) { size += count; }
+        ByteCounter& operator+=(char) { ++size; return *this; }
+        ByteCounter& operator+=(const char* text) { size += char_traits<char>::length(text); return *this; }
+    };
+
+    /** Output into memory that is already sized for it, for bands encoded in place. */
+    struct ByteWriter {
+        char* at;
+
+        void append(const char* data, size_t count) { memcpy(at, data, count); at += count; }
+        ByteWriter& operator+=(char c) { *at++ = c; return *this; }
+        ByteWriter& operator+=(const char* text) { append(text, char_traits<char>::length(text)); return *this; }
+    };
+
+    template<typename Output>
+    void AppendDecimal(Output& buffer, uint8_t value) {
+        buffer.append(Decimals.text[value], Decimals.size[value]);
+    }
+
+    /** Append the SGR parameters that select a color by its ColorKey. */
+    template<typename Output>
+    void AppendColor(Output& buffer, bool fg, uint32_t key) {
+        switch (colorMode) {
+            case Color::Mode::Indexed256:
+                buffer.append(fg ? "38;5;" : "48;5;", 5);
+                AppendDecimal(buffer, static_cast<uint8_t>(key));
+                return;
+            case Color::Mode::Indexed16:
+                // 30-37 and 90-97 for the fore-, 40-47 and 100-107 for the background
+                AppendDecimal(buffer, static_cast<uint8_t>((key < 8 ? 30 + key : 90 + key - 8) + (fg ? 0 : 10)));
+                return;
+            case Color::Mode::TrueColor:
+                break;
+        }
+        buffer.append(fg ? "38;2;" : "48;2;", 5);
+        AppendDecimal(buffer, static_cast<uint8_t>(key >> 16));
+        buffer += ';';
+        AppendDecimal(buffer, static_cast<uint8_t>(key >> 8));
+        buffer += ';';
+        AppendDecimal(buffer, static_cast<uint8_t>(key));
+    }
+
+    template<typename Output>
+    void AppendCell(Output& buffer, SGRState& sgr, const Cell& cell, EncodeStats& stats) {
+        uint32_t fg = (cell.flags & HasFg) ? ColorKey(cell.fg) : 0;
+        uint32_t bg = (cell.flags & HasBg) ? ColorKey(cell.bg) : 0;
+        bool fgChanged = (cell.flags & HasFg) ? !(sgr.flags & HasFg) || sgr.fg != fg : (sgr.flags & HasFg);
+        bool bgChanged = (cell.flags & HasBg) ? !(sgr.flags & HasBg) || sgr.bg != bg : (sgr.flags & HasBg);
+
+        if (fgChanged || bgChanged) {
+            if (cell.flags == 0) {
+                buffer += "\033[0m";
+            } else {
+                // One sequence for both changes, 39/49 restore the default color of a single channel
+                buffer += "\033[";
+                if (fgChanged) {
+                    if (cell.flags & HasFg) AppendColor(buffer, true, fg);
+                    else buffer += "39";
+                }
+                if (bgChanged) {
+                    if (fgChanged) buffer += ';';
+                    if (cell.flags & HasBg) AppendColor(buffer, false, bg);
+                    else buffer += "49";
+                }
+                buffer += 'm';
+            }
+            sgr = {cell.flags, fg, bg};
+            ++stats.sequences;
+        }
+
+        buffer.append(cell.glyph, cell.glyphSize);
+        ++stats.cells;
+    }
+
+    template<typename Output>
+    void AppendReset(Output& buffer, SGRState& sgr, uint8_t flags = HasFg | HasBg) {
+        if (!(sgr.flags & flags)) return;
+        buffer += "\033[0m";
+        sgr.flags = 0;
+    }
+
+    void AppendCursorMove(string& buffer, size_t count, char direction) {
+        if (count == 0) return;
+        buffer += "\033[";
+        if (count > 1) buffer += to_string(count);
+        buffer += direction;
+    }
+}
+
+void Render::SetColorMode(Color::Mode mode) {
+    colorMode = mode;
+}
+
+namespace {
+    /** Encode rows [first, last) of a grid. Starts and ends with the terminal's default colors. */
+    template<typename Output>
+    void EncodeRows(Output& buffer, const CellGrid& grid, size_t first, size_t last, bool clearLines, EncodeStats& counts) {
+        SGRState sgr;
+        for (size_t row = first; row < last; row++) {
+            // Skip trailing blanks so text rows are not padded to the grid width
+            size_t end = grid.width;
+            while (end > 0) {
+                const Cell& cell = At(grid, end - 1, row);
+                if (cell.flags != 0 || cell.glyphSize != 1 || cell.glyph[0] != ' ') break;
+                --end;
+            }
+
+            for (size_t col = 0; col < end; col++) AppendCell(buffer, sgr, At(grid, col, row), counts);
+
+            // A background that is still set would bleed into erased or newly scrolled in lines
+            AppendReset(buffer, sgr, HasBg);
+            if (clearLines) buffer += "\033[K";
+            buffer += "\n";
+        }
+        AppendReset(buffer, sgr);
+    }
+}
+
+void Render::RenderCells(string& buffer, const CellGrid& grid, bool clearLines, EncodeStats* stats) {
+    EncodeStats counts{};
+    size_t start = buffer.size();
+
+    size_t bands = Parallel::Bands(grid.height, grid.cells.size());
+    if (bands == 1) {
+        buffer.reserve(start + grid.height * (grid.width * MaxCellBytes + 8));
+        EncodeRows(buffer, grid, 0, grid.height, clearLines, counts);
+    } else {
+        // Measure every band first, then grow the buffer once and encode each band straight to its place.
+        // Each band ends on default colors, so the next one can start from a fresh SGR state.
+        vector<size_t> offsets(bands + 1);
+        vector<EncodeStats> bandCounts(bands);
+        Parallel::Pool().Run(bands, [&](size_t band) {
+            ByteCounter counter;
+            EncodeRows(counter, grid, band * grid.height / bands, (band + 1) * grid.height / bands,
+                clearLines, bandCounts[band]);
+            offsets[band + 1] = counter.size;
+        });
+
+        offsets[0] = start;
+        for (size_t band = 0; band < bands; band++) {
+            offsets[band + 1] += offsets[band];
+            counts.cells += bandCounts[band].cells;
+            counts.sequences += bandCounts[band].sequences;
+        }
+        buffer.resize(offsets[bands]);
+        Parallel::Pool().Run(bands, [&](size_t band) {
+            ByteWriter writer{buffer.data() + offsets[band]};
+            EncodeStats unused{};
+            EncodeRows(writer, grid, band * grid.height / bands, (band + 1) * grid.height / bands,
+                clearLines, unused);
+        });
+    }
+
+    counts.bytes = buffer.size() - start;
+    if (stats) *stats = counts;
+}
+
+bool Render::RenderDiff(string& buffer, const CellGrid& prev, const CellGrid& next, EncodeStats* stats) {
+    if (prev.width != next.width || prev.height != next.height) return false;
+
+    size_t changed = 0;
+    for (size_t i = 0; i < next.cells.size(); i++) {
+        if (!(prev.cells[i] == next.cells[i])) ++changed;
+    }
+    if (changed * 2 > next.cells.size()) return false;
+
+    EncodeStats counts{};
+    size_t bufferStart = buffer.size();
+    buffer.reserve(bufferStart + changed * (MaxCellBytes + 8));
+
+    SGRState sgr;
+    size_t cursorRow = 0, cursorCol = 0;
+    for (size_t row = 0; row < next.height && changed > 0; row++) {
+        size_t col = 0;
+        while (col < next.width) {
+            while (col < next.width && At(prev, col, row) == At(next, col, row)) ++col;
+            if (col == next.width) break;
+
+            // Extend the run over short gaps of unchanged cells
+            size_t start = col, end = col + 1;
+            for (size_t gap = 0; col + 1 < next.width && gap <= MaxDiffGap;) {
+                ++col;
+                if (At(prev, col, row) == At(next, col, row)) {
+                    ++gap;
+                } else {
+                    gap = 0;
+                    end = col + 1;
+                }
+            }
+            col = end;
+
+            AppendCursorMove(buffer, row - cursorRow, 'B');
+            if (start < cursorCol || row != cursorRow) {
+                buffer += '\r';
+                cursorCol = 0;
+            }
+            AppendCursorMove(buffer, start - cursorCol, 'C');
+
+            for (size_t x = start; x < end; x++) {
+                if (!(At(prev, x, row) == At(next, x, row))) --changed;
+                AppendCell(buffer, sgr, At(next, x, row), counts);
+            }
+            cursorRow = row;
+            cursorCol = end;
+        }
+    }
+
+    AppendReset(buffer, sgr);
+    AppendCursorMove(buffer, cursorRow, 'A');
+    buffer += '\r';
+
+    counts.bytes = buffer.size() - bufferStart;
+    if (stats) *stats = counts;
+    return true;
+}
+
+void Render::RenderANSIString(string& buffer, RenderBuffer& rb) {
+    CellGrid grid;
+    Clear(grid, CellsAcross(rb.width, rb.mode), CellsDown(rb.height, rb.mode));
+    BlitPixels(grid, View(rb), 0, 0);
+    RenderCells(buffer, grid);
+}
+
+Render::Pixel Render::GetShadeColor(size_t width, size_t height, float hue, size_t x, size_t y, ShadeModel model) {
+    float lightness = 1.0f - Position(y, height); // top is bright, bottom is dark
+
+    if (model == ShadeModel::OKLCH) {
+        Color::RGB rgb;
+        Color::OKLCHtoRGB(rgb, ShadeOKLCH(width, x, lightness, Color::MaxChroma(lightness, hue * 360.0f), hue));
+        return rgb;
+    }
+
+    float saturation = Position(x, width);        // left is gray, right is full color
     
     Color::RGB rgb;
     Color::HSLtoRGB(rgb, {hue, saturation, lightness});
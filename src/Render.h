@@ -2,34 +2,138 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include "Color.h"
 
 namespace Render {
-    
+
     typedef Color::RGB Pixel;
 
+    /** How pixels are packed into terminal cells: Half puts two vertical pixels into a cell (▀), Quadrant 2x2 (▚),
+    Sextant 2x3 (🬗) and Braille 2x4 dots. The packed modes show every cell in the two colors that fit its pixels best. */
+    enum class PixelMode : uint8_t { Half, Quadrant, Sextant, Braille };
+
+    /** Pixels are stored row-major in one contiguous block of width * height. */
     struct RenderBuffer {
         size_t width;
         size_t height;
-        std::vector<std::vector<Pixel>> pixelMatrix;
+        std::vector<Pixel> pixels;
+        PixelMode mode = PixelMode::Half;
+    };
+
+    /** Rectangular window into a RenderBuffer. Rows are `stride` pixels apart. */
+    struct RenderView {
+        Pixel* data;
+        size_t width;
+        size_t height;
+        size_t stride;
+        PixelMode mode = PixelMode::Half;
+    };
+
+    /** A single terminal cell: one UTF-8 glyph with optional fore- and background color. */
+    struct Cell {
+        char glyph[4];
+        uint8_t glyphSize;
+        uint8_t flags;
+        Pixel fg;
+        Pixel bg;
+    };
+
+    enum CellFlags : uint8_t {
+        HasFg = 1 << 0,
+        HasBg = 1 << 1,
+    };
+
+    /** Grid of terminal cells that all parts of a frame are blitted into. */
+    struct CellGrid {
+        size_t width;
+        size_t height;
+        std::vector<Cell> cells;
+    };
+
+    /** Color model a shade map spans. HSL maps saturation and lightness; OKLCH maps chroma (up to the most
+    saturated color sRGB can show) and lightness, so equal steps look equally far apart. */
+    enum class ShadeModel { HSL, OKLCH };
+
+    /** Output volume reported by RenderCells and RenderDiff. */
+    struct EncodeStats {
+        size_t bytes;       // Bytes appended to the buffer
+        size_t cells;       // Cells written
+        size_t sequences;   // SGR sequences written
     };
 
-    /** Helper function to calculate RenderBuffer width and height values from pixelMatrix. */
-    void CalcSize(RenderBuffer& rb);
+    /** Pixels a cell covers horizontally and vertically in a mode. */
+    inline size_t CellWidth(PixelMode mode) { return mode == PixelMode::Half ? 1 : 2; }
+    inline size_t CellHeight(PixelMode mode) {
+        constexpr size_t heights[] = {2, 2, 3, 4};
+        return heights[static_cast<size_t>(mode)];
+    }
+
+    /** Cells it takes to show width x height pixels in a mode. */
+    inline size_t CellsAcross(size_t width, PixelMode mode) { return (width + CellWidth(mode) - 1) / CellWidth(mode); }
+    inline size_t CellsDown(size_t height, PixelMode mode) { return (height + CellHeight(mode) - 1) / CellHeight(mode); }
+
+    inline Pixel& At(RenderBuffer& rb, size_t x, size_t y) { return rb.pixels[y * rb.width + x]; }
+    inline const Pixel& At(const RenderBuffer& rb, size_t x, size_t y) { return rb.pixels[y * rb.width + x]; }
+    inline Pixel& At(const RenderView& view, size_t x, size_t y) { return view.data[y * view.stride + x]; }
+    inline Cell& At(CellGrid& grid, size_t col, size_t row) { return grid.cells[row * grid.width + col]; }
+    inline const Cell& At(const CellGrid& grid, size_t col, size_t row) { return grid.cells[row * grid.width + col]; }
 
-    /** Fill the whole RenderBuffer.pixelMatrix with a specific color. */
+    bool operator==(const Cell& a, const Cell& b);
+
+    /** View of a RenderBuffer region (the whole buffer by default). The region is clipped to the buffer. */
+    RenderView View(RenderBuffer& rb);
+    RenderView View(RenderBuffer& rb, size_t x, size_t y, size_t width, size_t height);
+
+    /** Fill the whole RenderBuffer with a specific color. */
     void Fill(RenderBuffer& rb, const Pixel pixel);
 
-    /** Generate a map that holds diferent Shades of a given hue. */
-    bool GenerateShadeMap(RenderBuffer& rb, float hue);
+    /** Fill every pixel of a view with a specific color. */
+    void Fill(const RenderView& view, const Pixel pixel);
+
+    /** Generate a map that holds diferent Shades of a given hue (0-1). */
+    bool GenerateShadeMap(RenderBuffer& rb, float hue, ShadeModel model = ShadeModel::HSL);
+
+    /** Generate only the rb.width x rb.height pixels at (x, y) of a mapWidth x mapHeight shade map,
+    so a magnified map is computed where it is shown. Returns false if the region is not inside the map. */
+    bool GenerateShadeRegion(RenderBuffer& rb, float hue, size_t mapWidth, size_t mapHeight, size_t x, size_t y,
+                             ShadeModel model = ShadeModel::HSL);
 
     /** Generates a map that holds all hues in the RGB color spectrum. */
-    bool GenerateHueMap(RenderBuffer& rb);
+    bool GenerateHueMap(RenderBuffer& rb, ShadeModel model = ShadeModel::HSL);
+
+    /** Resize a CellGrid and reset every cell to an uncolored space. */
+    void Clear(CellGrid& grid, size_t width, size_t height);
+
+    /** Blit pixels into the grid at (col, row), packing them into cells as the view's mode says. */
+    void BlitPixels(CellGrid& grid, const RenderView& view, size_t col, size_t row);
+
+    /** Copy the cells of another grid into the grid at (col, row). */
+    void BlitCells(CellGrid& grid, const CellGrid& cells, size_t col, size_t row);
+
+    /** Blit text into the grid starting at (col, row). Newlines continue on the next row at col.
+    Text running past the grid is clipped. */
+    void BlitText(CellGrid& grid, std::string_view text, size_t col, size_t row);
+    void BlitText(CellGrid& grid, std::string_view text, size_t col, size_t row, const Pixel fg);
+
+    /** Set how RenderCells and RenderDiff send colors (truecolor by default). Call it before rendering starts,
+    not while frames are encoded. */
+    void SetColorMode(Color::Mode mode);
+
+    /** Converts a CellGrid into ANSI text, one line per row. Trailing uncolored spaces of a row are omitted.
+    With clearLines every row also erases what is left of the terminal line from a previous frame.
+    Colors are only sent when they change from one cell to the next. */
+    void RenderCells(std::string& buffer, const CellGrid& grid, bool clearLines = false, EncodeStats* stats = nullptr);
+
+    /** Converts only the cells of next that differ from prev into ANSI text, using relative cursor moves.
+    The cursor is expected at cell (0, 0) of the frame and is moved back there at the end.
+    Returns false and writes nothing if the grids differ in size or too many cells changed for a diff to pay off. */
+    bool RenderDiff(std::string& buffer, const CellGrid& prev, const CellGrid& next, EncodeStats* stats = nullptr);
 
     /** Converts and outputs a RenderBuffer object into
     a std::string buffer by rendering pixels as ascii characters with RGB ansi color. */
     void RenderANSIString(std::string& buffer, RenderBuffer& rb);
 
-    Pixel GetShadeColor(size_t width, size_t height, float hue, size_t x, size_t y);
+    Pixel GetShadeColor(size_t width, size_t height, float hue, size_t x, size_t y, ShadeModel model = ShadeModel::HSL);
 }
\ No newline at end of file
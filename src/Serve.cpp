@@ -0,0 +1,413 @@
+#include "Serve.h"
+#include "Convert.h"
+#include "Render.h"
+#include "Template.h"
+#include "Utility.h"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    constexpr size_t ReadSize = 64 << 10;       // Bytes read per read(2)
+    constexpr size_t MaxPending = 1 << 20;      // A client's unsent responses stop reading its requests
+    constexpr size_t PreviewWidth = 8;          // Cells of a preview swatch
+
+    volatile sig_atomic_t stopRequested = 0;
+
+    void requestStop(int) {
+        stopRequested = 1;
+    }
+
+    /** Cut the next space separated word off line. */
+    std::string_view NextWord(std::string_view& line) {
+        while (!line.empty() && line.front() == ' ') line.remove_prefix(1);
+        size_t end = line.find(' ');
+        std::string_view word = line.substr(0, end);
+        line.remove_prefix(end == std::string_view::npos ? line.size() : end + 1);
+        return word;
+    }
+
+    void AppendColor(std::string& out, const Color::RGB& rgb, Color::Format format) {
+        const Template::Program& program = Template::ForFormat(format);
+        size_t start = out.size();
+        out.resize(start + program.maxSize);
+        out.resize(start + Template::Format(out.data() + start, program, rgb));
+    }
+
+    /** Answer one request without its newline. Returns the kind of request for the stats. */
+    Stats::Request AnswerLine(std::string& out, std::string_view line, const Palette::Index& palette,
+                              const Stats::RequestRecorder& stats) {
+        if (line.size() > Serve::MaxRequestSize) {
+            out += "error request too long";
+            return Stats::Request::Invalid;
+        }
+        std::string_view command = NextWord(line);
+        Color::Format from, to;
+        Color::RGB rgb;
+
+        if (command == "convert" || command == "nearest") {
+            if (!Convert::ParseFormat(NextWord(line), from) || !Convert::ParseFormat(NextWord(line), to)) {
+                out += "error unknown format";
+                return Stats::Request::Invalid;
+            }
+            if (!Convert::ParseColor(rgb, line, from)) {
+                out += "error invalid color";
+                return Stats::Request::Invalid;
+            }
+            if (command == "convert") {
+                AppendColor(out, rgb, to);
+                return Stats::Request::Convert;
+            }
+
+            Palette::Match match;
+            if (!palette.Nearest(rgb, match)) {
+                out += "error no palette, start the server with --palette";
+                return Stats::Request::Invalid;
+            }
+            AppendColor(out, match.rgb, to);
+            out += ' ';
+            out += match.name;
+            return Stats::Request::Nearest;
+        }
+
+        if (command == "preview") {
+            if (!Convert::ParseFormat(NextWord(line), from)) {
+                out += "error unknown format";
+                return Stats::Request::Invalid;
+            }
+            if (!Convert::ParseColor(rgb, line, from)) {
+                out += "error invalid color";
+                return Stats::Request::Invalid;
+            }
+
+            // One row of cells, RenderANSIString ends it with a newline before the reset that is dropped here
+            static Render::RenderBuffer swatch{PreviewWidth, 2, std::vector<Render::Pixel>(PreviewWidth * 2)};
+            Render::Fill(swatch, rgb);
+            size_t start = out.size();
+            Render::RenderANSIString(out, swatch);
+            size_t nl = out.find('\n', start);
+            if (nl != std::string::npos) out.erase(nl, 1);
+            return Stats::Request::Preview;
+        }
+
+        if (command == "stats") {
+            if (stats.isEnabled()) stats.summary(out);
+            else out += "error stats are off, start the server with --stats";
+            return Stats::Request::Stats;
+        }
+
+        out += "error unknown request";
+        return Stats::Request::Invalid;
+    }
+
+    /** A connected client, its unanswered input and unsent output. */
+    struct Connection {
+        int fd;
+        std::string in;
+        std::string out;
+        size_t sent = 0;
+        bool readClosed = false;
+        bool skipping = false;      // Dropping the rest of a request that was too long
+    };
+
+    /** Write as much pending output as the socket takes without blocking. Returns false on errors. */
+    bool Flush(Connection& connection) {
+        while (connection.sent < connection.out.size()) {
+            ssize_t n = send(connection.fd, connection.out.data() + connection.sent,
+                             connection.out.size() - connection.sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            connection.sent += static_cast<size_t>(n);
+        }
+        connection.out.clear();
+        connection.sent = 0;
+        return true;
+    }
+
+    /** Read what the client sent and answer all complete lines as one batch. Returns false on errors. */
+    bool Receive(Connection& connection, std::vector<char>& buffer, const Palette::Index& palette,
+                 Stats::RequestRecorder& stats) {
+        ssize_t n = read(connection.fd, buffer.data(), buffer.size());
+        if (n < 0) return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+        if (n == 0) connection.readClosed = true;
+        std::string_view data(buffer.data(), static_cast<size_t>(n));
+
+        // The rest of a request that was answered as too long is dropped up to its newline
+        if (connection.skipping) {
+            size_t nl = data.find('\n');
+            if (nl == std::string_view::npos) return true;
+            data.remove_prefix(nl + 1);
+            connection.skipping = false;
+        }
+        connection.in.append(data);
+
+        // A last line without newline is answered once the client stops sending
+        size_t complete = connection.readClosed ? connection.in.size() : connection.in.rfind('\n') + 1;
+        size_t before = connection.out.size();
+        if (complete > 0) {
+            Serve::Answer(connection.out, std::string_view(connection.in.data(), complete), palette, stats);
+            connection.in.erase(0, complete);
+        }
+
+        // A request that is still growing past the limit is answered now, so a client can not make in grow forever
+        if (connection.in.size() > Serve::MaxRequestSize) {
+            Serve::Answer(connection.out, connection.in, palette, stats);
+            connection.in.clear();
+            connection.skipping = true;
+        }
+
+        if (connection.out.size() == before) return true;
+        stats.recordBatch(connection.out.size() - before);
+        return Flush(connection);
+    }
+
+    bool FillAddress(sockaddr_un& address, const std::string& path) {
+        if (path.empty()) return false;     // DefaultPath already said why there is none
+        address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path '" << path << "' is too long!\n";
+            return false;
+        }
+        memcpy(address.sun_path, path.data(), path.size());
+        return true;
+    }
+
+    int Connect(const sockaddr_un& address) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /** True if the process at the other end of a connected socket runs as the same user. */
+    bool SameUser(int fd) {
+        ucred peer;
+        socklen_t size = sizeof(peer);
+        return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 && peer.uid == getuid();
+    }
+
+    void SetNonBlocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+}
+
+std::string Serve::DefaultPath() {
+    const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) return std::string(runtime) + "/clid.sock";
+
+    // /tmp is shared, the socket goes into a directory that only this user can enter. One that someone else
+    // created first or that others can get into is not used
+    std::string dir = "/tmp/clid-" + std::to_string(getuid());
+    struct stat info;
+    if ((mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) || lstat(dir.c_str(), &info) != 0 ||
+        !S_ISDIR(info.st_mode) || info.st_uid != getuid() || (info.st_mode & 077) != 0) {
+        std::cerr << "'" << dir << "' is not a private directory, give the socket path to --serve/--client!\n";
+        return "";
+    }
+    return dir + "/clid.sock";
+}
+
+void Serve::Answer(std::string& out, std::string_view lines, const Palette::Index& palette,
+                   Stats::RequestRecorder& stats) {
+    while (!lines.empty()) {
+        size_t nl = lines.find('\n');
+        std::string_view line = lines.substr(0, nl);
+        lines.remove_prefix(nl == std::string_view::npos ? lines.size() : nl + 1);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+        if (!stats.isEnabled()) {
+            AnswerLine(out, line, palette, stats);
+        } else {
+            auto start = Clock::now();
+            Stats::Request request = AnswerLine(out, line, palette, stats);
+            stats.record(request, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        }
+        out += '\n';
+    }
+}
+
+bool Serve::Run(const std::string& path, const Palette::Index& palette, Stats::RequestRecorder& stats) {
+    sockaddr_un address;
+    if (!FillAddress(address, path)) return false;
+
+    // A socket file nobody listens on is left over from a server that was killed. Anything else at the path
+    // is not ours to remove
+    int running = Connect(address);
+    if (running >= 0) {
+        close(running);
+        std::cerr << "A server is already listening on '" << path << "'!\n";
+        return false;
+    }
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            std::cerr << "'" << path << "' exists and is not a socket!\n";
+            return false;
+        }
+        unlink(path.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(0077);  // Only the owner may connect
+    bool bound = listener >= 0 && bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    umask(mask);
+    if (!bound || listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Could not listen on '" << path << "'!\n";
+        if (listener >= 0) close(listener);
+        return false;
+    }
+    SetNonBlocking(listener);
+
+    // Without SA_RESTART so poll() returns when the server is asked to stop
+    struct sigaction stop = {};
+    stop.sa_handler = requestStop;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, nullptr);
+    sigaction(SIGTERM, &stop, nullptr);
+
+    std::cerr << "Listening on " << path << "\n";
+
+    std::vector<Connection> connections;
+    std::vector<pollfd> fds;
+    std::vector<char> buffer(ReadSize);
+    bool ok = true;
+
+    while (!stopRequested) {
+        fds.clear();
+        fds.push_back({listener, POLLIN, 0});
+        for (const Connection& connection : connections) {
+            short events = 0;
+            if (!connection.readClosed && connection.out.size() - connection.sent < MaxPending) events |= POLLIN;
+            if (connection.sent < connection.out.size()) events |= POLLOUT;
+            fds.push_back({connection.fd, events, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+
+        // Handle the clients first, fds and connections line up only until new ones are accepted
+        for (size_t i = connections.size(); i-- > 0;) {
+            Connection& connection = connections[i];
+            short revents = fds[i + 1].revents;
+            bool alive = true;
+            if (!connection.readClosed && (revents & (POLLIN | POLLHUP))) alive = Receive(connection, buffer, palette, stats);
+            if (alive && (revents & POLLOUT)) alive = Flush(connection);
+            if (revents & POLLERR) alive = false;
+
+            if (!alive || (connection.readClosed && connection.out.empty())) {
+                close(connection.fd);
+                connections.erase(connections.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                connections.push_back({fd, {}, {}});
+            }
+        }
+    }
+
+    for (const Connection& connection : connections) close(connection.fd);
+    close(listener);
+    unlink(path.c_str());
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    return ok;
+}
+
+bool Serve::Client(const std::string& path) {
+    sockaddr_un address;
+    if (!FillAddress(address, path)) return false;
+
+    int fd = Connect(address);
+    if (fd < 0) {
+        std::cerr << "No server is listening on '" << path << "', start one with clid --serve!\n";
+        return false;
+    }
+    if (!SameUser(fd)) {
+        close(fd);
+        std::cerr << "The server on '" << path << "' belongs to another user!\n";
+        return false;
+    }
+    SetNonBlocking(fd);
+
+    // Requests are forwarded as they come and responses read at the same time, so neither side
+    // blocks on a full socket while the other one waits for it
+    std::vector<char> buffer(ReadSize);
+    std::string pending;
+    size_t sent = 0;
+    bool inputOpen = true;
+    bool ok = true;
+
+    while (true) {
+        pollfd fds[2] = {
+            {fd, static_cast<short>(POLLIN | (sent < pending.size() ? POLLOUT : 0)), 0},
+            {STDIN_FILENO, POLLIN, 0},
+        };
+        nfds_t count = inputOpen && pending.empty() ? 2 : 1;
+        if (poll(fds, count, -1) < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(fd, buffer.data(), buffer.size());
+            if (n < 0 && errno != EINTR && errno != EAGAIN) { ok = false; break; }
+            if (n == 0) break;  // The server answered everything and closed
+            if (n > 0 && !Utility::WriteAll(STDOUT_FILENO, buffer.data(), static_cast<size_t>(n))) { ok = false; break; }
+        } else if (fds[0].revents & POLLERR) {
+            ok = false;
+            break;
+        }
+
+        if (sent < pending.size()) {
+            ssize_t n = send(fd, pending.data() + sent, pending.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno != EINTR && errno != EAGAIN) { ok = false; break; }
+            if (n > 0) sent += static_cast<size_t>(n);
+            if (sent == pending.size()) {
+                pending.clear();
+                sent = 0;
+                if (!inputOpen) shutdown(fd, SHUT_WR);
+            }
+        }
+
+        if (count == 2 && (fds[1].revents & (POLLIN | POLLHUP))) {
+            ssize_t n = read(STDIN_FILENO, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                inputOpen = false;
+                if (pending.empty()) shutdown(fd, SHUT_WR);
+            } else {
+                pending.assign(buffer.data(), static_cast<size_t>(n));
+            }
+        }
+    }
+
+    close(fd);
+    if (!ok) std::cerr << "Lost the connection to the server!\n";
+    return ok;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include "Palette.h"
+#include "Stats.h"
+
+namespace Serve {
+
+    /** Socket used when --serve and --client are given no path: $XDG_RUNTIME_DIR/clid.sock, or
+    /tmp/clid-<uid>/clid.sock in a directory only the user can enter. Empty if that directory is not private. */
+    std::string DefaultPath();
+
+    /** Longest request line that is answered, longer ones get "error request too long". */
+    constexpr size_t MaxRequestSize = 4096;
+
+    /** Answer every request line of lines and append one response line per request to out. Requests:
+        convert <from> <to> <color>     The color in format <to>
+        nearest <from> <to> <color>     The nearest palette color in format <to> and its name
+        preview <from> <color>          A swatch of the color as one line of ANSI colored cells
+        stats                           Request count and latency percentiles (needs --stats)
+    <color> is the rest of the line in format <from>. Failed requests are answered with "error <reason>". */
+    void Answer(std::string& out, std::string_view lines, const Palette::Index& palette, Stats::RequestRecorder& stats);
+
+    /** Listen on a Unix socket at path and answer requests until SIGINT or SIGTERM.
+    Every client may pipeline any number of requests; all complete lines that arrived together are answered
+    as one batch with a single write. A stale socket at path is replaced, any other file is left alone.
+    Returns false if the socket can not be set up. */
+    bool Run(const std::string& path, const Palette::Index& palette, Stats::RequestRecorder& stats);
+
+    /** Send the request lines read from stdin to the server at path and copy the responses to stdout.
+    Refuses servers that run as another user. */
+    bool Client(const std::string& path);
+}
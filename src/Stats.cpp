@@ -0,0 +1,226 @@
+#include "Stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace Stats;
+
+// -------------------------------------------------------------
+// ALLOCATION COUNTING
+// -------------------------------------------------------------
+namespace {
+    // Shared by all threads so work on the thread pool is counted too, relaxed since only the total matters
+    std::atomic<bool> countingAllocations = false;
+    std::atomic<size_t> allocations = 0;
+}
+
+void* operator new(size_t size) {
+    if (countingAllocations.load(std::memory_order_relaxed)) allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+void Stats::CountAllocations(bool enabled) {
+    countingAllocations.store(enabled, std::memory_order_relaxed);
+}
+
+size_t Stats::Allocations() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+// -------------------------------------------------------------
+// RECORDER
+// -------------------------------------------------------------
+namespace {
+
+    const char* PhaseNames[] = {"generate", "highlight", "compose", "encode", "write"};
+    const char* RequestNames[] = {"convert", "nearest", "preview", "stats", "invalid"};
+
+    // Upper bounds of the latency histogram buckets in microseconds, the last bucket is open
+    const uint64_t BucketUs[] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000};
+    constexpr size_t BucketCount = sizeof(BucketUs) / sizeof(BucketUs[0]) + 1;
+    constexpr int HistogramWidth = 40;
+
+    /** Value at percentile p (0-100) of sorted values. */
+    uint64_t Percentile(const std::vector<uint64_t>& sorted, double p) {
+        if (sorted.empty()) return 0;
+        size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    /** Print the mean, p50, p99 and max of values (ns) in us. values is sorted in place. */
+    void PrintRow(FILE* out, const char* name, std::vector<uint64_t>& values) {
+        std::sort(values.begin(), values.end());
+        uint64_t sum = 0;
+        for (uint64_t value : values) sum += value;
+        double mean = values.empty() ? 0.0 : double(sum) / values.size();
+
+        std::fprintf(out, "  %-10s %10.1f %10.1f %10.1f %10.1f\n", name,
+            mean / 1000.0, Percentile(values, 50) / 1000.0, Percentile(values, 99) / 1000.0,
+            (values.empty() ? 0 : values.back()) / 1000.0);
+    }
+
+    /** Histogram bucket of a latency in ns. */
+    size_t HistogramBucket(uint64_t ns) {
+        uint64_t us = ns / 1000;
+        size_t b = 0;
+        while (b < BucketCount - 1 && us >= BucketUs[b]) b++;
+        return b;
+    }
+
+    /** Print a latency histogram from its bucket counts. */
+    void PrintBuckets(FILE* out, const char* title, const uint64_t (&buckets)[BucketCount]) {
+        uint64_t largest = *std::max_element(buckets, buckets + BucketCount);
+
+        std::fprintf(out, "%s:\n", title);
+        for (size_t b = 0; b < BucketCount; b++) {
+            char label[32];
+            if (b < BucketCount - 1) std::snprintf(label, sizeof(label), "< %llu us", static_cast<unsigned long long>(BucketUs[b]));
+            else std::snprintf(label, sizeof(label), ">= %llu us", static_cast<unsigned long long>(BucketUs[b - 1]));
+
+            int bar = largest ? static_cast<int>(buckets[b] * HistogramWidth / largest) : 0;
+            std::fprintf(out, "  %-12s |%-*.*s| %llu\n", label, HistogramWidth, bar,
+                "########################################", static_cast<unsigned long long>(buckets[b]));
+        }
+    }
+
+    /** Histogram of latencies in ns over the BucketUs buckets. */
+    void PrintHistogram(FILE* out, const char* title, const std::vector<uint64_t>& values) {
+        uint64_t buckets[BucketCount] = {};
+        for (uint64_t ns : values) buckets[HistogramBucket(ns)]++;
+        PrintBuckets(out, title, buckets);
+    }
+
+    void PrintHistogram(FILE* out, const char* title, const LatencyHistogram& latencies) {
+        uint64_t buckets[BucketCount] = {};
+        for (size_t b = 0; b < LatencyHistogram::Buckets; b++) {
+            if (latencies.bucketCount(b)) buckets[HistogramBucket(LatencyHistogram::BucketStart(b))] += latencies.bucketCount(b);
+        }
+        PrintBuckets(out, title, buckets);
+    }
+
+    /** Print the mean, p50, p99 and max of a latency histogram in us. */
+    void PrintRow(FILE* out, const char* name, const LatencyHistogram& latencies) {
+        std::fprintf(out, "  %-10s %10.1f %10.1f %10.1f %10.1f\n", name, latencies.mean() / 1000.0,
+            latencies.percentile(50) / 1000.0, latencies.percentile(99) / 1000.0, latencies.max() / 1000.0);
+    }
+}
+
+void Recorder::enable() {
+    enabled = true;
+    CountAllocations(true);
+}
+
+void Recorder::record(size_t bytes, const Render::EncodeStats& encoded, bool full) {
+    current.totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - frameStart).count();
+    current.bytes = bytes;
+    current.allocations = Allocations() - allocationsAtStart;
+    current.encoded = encoded;
+    current.full = full;
+    frames.push_back(current);
+}
+
+bool Recorder::writeReport(const std::string& path) const {
+    FILE* out = path.empty() ? stderr : std::fopen(path.c_str(), "w");
+    if (!out) return false;
+
+    size_t fullFrames = 0, bytes = 0, allocs = 0, cells = 0, sequences = 0;
+    for (const Frame& frame : frames) {
+        fullFrames += frame.full;
+        bytes += frame.bytes;
+        allocs += frame.allocations;
+        cells += frame.encoded.cells;
+        sequences += frame.encoded.sequences;
+    }
+    double count = frames.empty() ? 1.0 : double(frames.size());
+
+    std::fprintf(out, "clid stats: %zu frames (%zu full, %zu diff)\n",
+        frames.size(), fullFrames, frames.size() - fullFrames);
+    std::fprintf(out, "  %-10s %10s %10s %10s %10s\n", "phase (us)", "mean", "p50", "p99", "max");
+
+    std::vector<uint64_t> values(frames.size());
+    for (size_t phase = 0; phase < static_cast<size_t>(Phase::Count); phase++) {
+        for (size_t i = 0; i < frames.size(); i++) values[i] = frames[i].phaseNs[phase];
+        PrintRow(out, PhaseNames[phase], values);
+    }
+    for (size_t i = 0; i < frames.size(); i++) values[i] = frames[i].totalNs;
+    PrintRow(out, "total", values);
+
+    std::fprintf(out, "  bytes/frame %.1f (total %zu), cells/frame %.1f, sgr/frame %.1f, allocs/frame %.1f\n",
+        bytes / count, bytes, cells / count, sequences / count, allocs / count);
+
+    PrintHistogram(out, "frame latency", values);
+
+    bool ok = !std::ferror(out);
+    if (out != stderr) ok = std::fclose(out) == 0 && ok;
+    return ok;
+}
+
+// -------------------------------------------------------------
+// REQUEST RECORDER
+// -------------------------------------------------------------
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t b = 0; b < Buckets; b++) counts[b] += other.counts[b];
+    total += other.total;
+    sum += other.sum;
+    largest = std::max(largest, other.largest);
+}
+
+uint64_t LatencyHistogram::BucketStart(size_t bucket) {
+    if (bucket < SubBuckets) return bucket;
+    size_t exponent = bucket / SubBuckets + 2;
+    return (SubBuckets + bucket % SubBuckets) << (exponent - 3);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * (total - 1) + 0.5);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < Buckets; b++) {
+        seen += counts[b];
+        if (seen > rank) {
+            uint64_t end = b + 1 < Buckets ? BucketStart(b + 1) : largest + 1;
+            return std::min(largest, BucketStart(b) + (end - BucketStart(b)) / 2);
+        }
+    }
+    return largest;
+}
+
+void RequestRecorder::summary(std::string& out) const {
+    LatencyHistogram all;
+    for (const auto& latencies : requestNs) all.merge(latencies);
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "requests %llu batches %zu p50 %.1fus p99 %.1fus max %.1fus",
+        static_cast<unsigned long long>(all.count()), batches, all.percentile(50) / 1000.0,
+        all.percentile(99) / 1000.0, all.max() / 1000.0);
+    out += line;
+}
+
+bool RequestRecorder::writeReport(const std::string& path) const {
+    FILE* out = path.empty() ? stderr : std::fopen(path.c_str(), "w");
+    if (!out) return false;
+
+    LatencyHistogram all;
+    for (const auto& latencies : requestNs) all.merge(latencies);
+    double count = batches ? double(batches) : 1.0;
+
+    std::fprintf(out, "clid stats: %llu requests in %zu batches\n", static_cast<unsigned long long>(all.count()), batches);
+    std::fprintf(out, "  %-10s %10s %10s %10s %10s\n", "req (us)", "mean", "p50", "p99", "max");
+    for (size_t request = 0; request < static_cast<size_t>(Request::Count); request++) {
+        if (requestNs[request].count() == 0) continue;
+        PrintRow(out, RequestNames[request], requestNs[request]);
+    }
+    PrintRow(out, "all", all);
+    std::fprintf(out, "  requests/batch %.1f, bytes/batch %.1f (total %zu)\n", all.count() / count, bytes / count, bytes);
+    PrintHistogram(out, "request latency", all);
+
+    bool ok = !std::ferror(out);
+    if (out != stderr) ok = std::fclose(out) == 0 && ok;
+    return ok;
+}
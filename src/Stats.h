@@ -0,0 +1,148 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Render.h"
+
+namespace Stats {
+
+    /** The parts of a frame that are timed separately, in the order drawUI() runs them. */
+    enum class Phase { Generate, Highlight, Compose, Encode, Write, Count };
+
+    /** Everything recorded about one frame. */
+    struct Frame {
+        uint64_t phaseNs[static_cast<size_t>(Phase::Count)];
+        uint64_t totalNs;
+        size_t bytes;
+        size_t allocations;
+        Render::EncodeStats encoded;
+        bool full;              // Full redraw instead of a diff
+    };
+
+    /** Requests of `clid --serve` that are timed separately. */
+    enum class Request { Convert, Nearest, Preview, Stats, Invalid, Count };
+
+    /** Turn counting of heap allocations on or off. While off operator new only pays for one branch. */
+    void CountAllocations(bool enabled);
+
+    /** Heap allocations made by all threads while counting was on. */
+    size_t Allocations();
+
+    /** Collects per frame timings and output volume. Every call returns right away while the recorder is disabled. */
+    class Recorder {
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        bool enabled = false;
+        std::vector<Frame> frames;
+        Frame current{};
+        Clock::time_point frameStart;
+        Clock::time_point phaseStart;
+        size_t allocationsAtStart = 0;
+
+        void record(size_t bytes, const Render::EncodeStats& encoded, bool full);
+    public:
+        /** Start recording. Also turns on allocation counting. */
+        void enable();
+        bool isEnabled() const { return enabled; }
+
+        /** Start timing a new frame. */
+        void beginFrame() {
+            if (!enabled) return;
+            current = {};
+            allocationsAtStart = Allocations();
+            frameStart = phaseStart = Clock::now();
+        }
+
+        /** End a phase: everything since the last mark (or beginFrame) is added to it. */
+        void mark(Phase phase) {
+            if (!enabled) return;
+            auto now = Clock::now();
+            current.phaseNs[static_cast<size_t>(phase)] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - phaseStart).count();
+            phaseStart = now;
+        }
+
+        /** Finish the frame with the number of bytes written for it. */
+        void endFrame(size_t bytes, const Render::EncodeStats& encoded, bool full) {
+            if (enabled) record(bytes, encoded, full);
+        }
+
+        /** Write a summary with per phase percentiles and a frame latency histogram.
+        An empty path writes to stderr. Returns false if the file could not be written. */
+        bool writeReport(const std::string& path) const;
+    };
+
+    /** Latencies counted into fixed buckets, so a long running server records any number of them in constant memory.
+    Every power of two of nanoseconds is split into SubBuckets, percentiles are within 1 / SubBuckets of the truth.
+    Count, mean and max are exact. */
+    class LatencyHistogram {
+    public:
+        static constexpr size_t SubBuckets = 8;
+        static constexpr size_t Buckets = 62 * SubBuckets;
+    private:
+        uint64_t counts[Buckets] = {};
+        uint64_t total = 0;
+        uint64_t sum = 0;
+        uint64_t largest = 0;
+
+        static size_t Bucket(uint64_t ns) {
+            if (ns < SubBuckets) return static_cast<size_t>(ns);
+            unsigned exponent = 63 - __builtin_clzll(ns);
+            return (exponent - 2) * SubBuckets + ((ns >> (exponent - 3)) & (SubBuckets - 1));
+        }
+    public:
+        void add(uint64_t ns) {
+            counts[Bucket(ns)]++;
+            total++;
+            sum += ns;
+            largest = ns > largest ? ns : largest;
+        }
+
+        void merge(const LatencyHistogram& other);
+
+        uint64_t count() const { return total; }
+        double mean() const { return total ? double(sum) / total : 0.0; }
+        uint64_t max() const { return largest; }
+
+        /** Middle of the bucket that holds percentile p (0-100), never above max(). */
+        uint64_t percentile(double p) const;
+
+        /** Latencies per bucket, with the smallest latency of each bucket. */
+        uint64_t bucketCount(size_t bucket) const { return counts[bucket]; }
+        static uint64_t BucketStart(size_t bucket);
+    };
+
+    /** Collects the latency of every request a server answers and how they arrived in batches.
+    Every call returns right away while the recorder is disabled. */
+    class RequestRecorder {
+    private:
+        bool enabled = false;
+        LatencyHistogram requestNs[static_cast<size_t>(Request::Count)];
+        size_t batches = 0;
+        size_t bytes = 0;
+    public:
+        void enable() { enabled = true; }
+        bool isEnabled() const { return enabled; }
+
+        /** Add the time one request took to answer. */
+        void record(Request request, uint64_t ns) {
+            if (enabled) requestNs[static_cast<size_t>(request)].add(ns);
+        }
+
+        /** Add a batch of requests read at once and the bytes written in reply. */
+        void recordBatch(size_t written) {
+            if (!enabled) return;
+            ++batches;
+            bytes += written;
+        }
+
+        /** One line with the request count and latency percentiles over all requests. */
+        void summary(std::string& out) const;
+
+        /** Write a summary with per request percentiles and a latency histogram.
+        An empty path writes to stderr. Returns false if the file could not be written. */
+        bool writeReport(const std::string& path) const;
+    };
+}
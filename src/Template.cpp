@@ -0,0 +1,290 @@
+#include "Template.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+
+using namespace Template;
+
+namespace {
+
+    constexpr size_t BatchSize = 256;       // Colors converted at a time by FormatLines
+    constexpr int MaxPrecision = 9;
+    constexpr size_t FieldCount = static_cast<size_t>(Field::LabB) + 1;
+
+    // Color spaces a field is computed from
+    enum Space : unsigned {
+        NoSpace = 0,
+        HSLSpace = 1 << 0,
+        CMYKSpace = 1 << 1,
+        OKLabSpace = 1 << 2,
+        OKLCHSpace = 1 << 3,
+        LabSpace = 1 << 4,
+    };
+
+    struct FieldInfo {
+        std::string_view name;
+        Field field;
+        unsigned space;
+    };
+
+    const FieldInfo Fields[] = {
+        {"r", Field::R, NoSpace}, {"g", Field::G, NoSpace}, {"b", Field::B, NoSpace}, {"hex", Field::Hex, NoSpace},
+        {"h", Field::H, HSLSpace}, {"s", Field::S, HSLSpace}, {"l", Field::L, HSLSpace}, {"deg", Field::Degrees, HSLSpace},
+        {"c", Field::C, CMYKSpace}, {"m", Field::M, CMYKSpace}, {"y", Field::Y, CMYKSpace}, {"k", Field::K, CMYKSpace},
+        {"ok.l", Field::OkL, OKLabSpace}, {"ok.a", Field::OkA, OKLabSpace}, {"ok.b", Field::OkB, OKLabSpace},
+        {"ok.c", Field::OkC, OKLCHSpace}, {"ok.h", Field::OkH, OKLCHSpace},
+        {"lab.l", Field::LabL, LabSpace}, {"lab.a", Field::LabA, LabSpace}, {"lab.b", Field::LabB, LabSpace},
+    };
+
+    /** Most chars a field can take. Numbers are bounded by the color spaces, none is more than 3 digits
+    before the point, the shortest form is at most "-1.23457e-05". */
+    size_t FieldSize(Field field, int precision) {
+        if (field == Field::Hex) return 7;
+        if (precision < 0) return field <= Field::B ? 3 : 12;
+        return 5 + precision;
+    }
+
+    void AddLiteral(Program& program, std::string_view text) {
+        if (text.empty()) return;
+        if (!program.ops.empty() && program.ops.back().field == Field::Literal) {
+            program.ops.back().size += static_cast<uint32_t>(text.size());
+        } else {
+            program.ops.push_back({Field::Literal, -1, static_cast<uint32_t>(program.literals.size()),
+                                   static_cast<uint32_t>(text.size())});
+        }
+        program.literals += text;
+        program.maxSize += text.size();
+    }
+
+    /** Parse "name" or "name:.N" between the braces of a field. */
+    bool AddField(Program& program, std::string_view spec) {
+        int precision = -1;
+        size_t colon = spec.find(':');
+        if (colon != std::string_view::npos) {
+            std::string_view digits = spec.substr(colon + 1);
+            if (digits.size() < 2 || digits[0] != '.') return false;
+            auto [end, ec] = std::from_chars(digits.data() + 1, digits.data() + digits.size(), precision);
+            if (ec != std::errc() || end != digits.data() + digits.size() || precision < 0 || precision > MaxPrecision) {
+                return false;
+            }
+            spec = spec.substr(0, colon);
+        }
+
+        for (const FieldInfo& info : Fields) {
+            if (info.name != spec) continue;
+            program.ops.push_back({info.field, static_cast<int8_t>(precision), 0, 0});
+            program.spaces |= info.space;
+            program.maxSize += FieldSize(info.field, precision);
+            return true;
+        }
+        return false;
+    }
+
+    /** Converted values of one color, indexed by Field. */
+    struct Values {
+        float v[FieldCount];
+
+        float& operator[](Field field) { return v[static_cast<size_t>(field)]; }
+        float operator[](Field field) const { return v[static_cast<size_t>(field)]; }
+    };
+
+    void SetHSL(Values& values, const Color::HSL& hsl) {
+        values[Field::H] = hsl.h * 100.0f;
+        values[Field::S] = hsl.s * 100.0f;
+        values[Field::L] = hsl.l * 100.0f;
+        values[Field::Degrees] = hsl.h * 360.0f;
+    }
+
+    void SetCMYK(Values& values, const Color::CMYK& cmyk) {
+        values[Field::C] = cmyk.c * 100.0f;
+        values[Field::M] = cmyk.m * 100.0f;
+        values[Field::Y] = cmyk.y * 100.0f;
+        values[Field::K] = cmyk.k * 100.0f;
+    }
+
+    void SetOKLab(Values& values, const Color::OKLab& lab) {
+        values[Field::OkL] = lab.L;
+        values[Field::OkA] = lab.a;
+        values[Field::OkB] = lab.b;
+    }
+
+    void SetOKLCH(Values& values, const Color::OKLCH& lch) {
+        values[Field::OkL] = lch.L;
+        values[Field::OkC] = lch.C;
+        values[Field::OkH] = lch.h;
+    }
+
+    void SetLab(Values& values, const Color::Lab& lab) {
+        values[Field::LabL] = lab.L;
+        values[Field::LabA] = lab.a;
+        values[Field::LabB] = lab.b;
+    }
+
+    char* WriteUint(char* p, unsigned value) {
+        return std::to_chars(p, p + 3, value).ptr;
+    }
+
+    /** Without a precision the same text as printing a float through std::ostream with default precision. */
+    char* WriteFloat(char* p, float value, int precision) {
+        if (precision < 0) return std::to_chars(p, p + 16, value, std::chars_format::general, 6).ptr;
+        return std::to_chars(p, p + 16, value, std::chars_format::fixed, precision).ptr;
+    }
+
+    char* Emit(char* p, const Program& program, const Color::RGB& rgb, const Values& values) {
+        for (const Op& op : program.ops) {
+            switch (op.field) {
+                case Field::Literal:
+                    memcpy(p, program.literals.data() + op.offset, op.size);
+                    p += op.size;
+                    break;
+                case Field::Hex: {
+                    char hex[8];
+                    size_t length = Color::EncodeHEX(hex, rgb);
+                    memcpy(p, hex, length);
+                    p += length;
+                    break;
+                }
+                case Field::R:
+                case Field::G:
+                case Field::B: {
+                    uint8_t channel = op.field == Field::R ? rgb.r : (op.field == Field::G ? rgb.g : rgb.b);
+                    p = op.precision < 0 ? WriteUint(p, channel) : WriteFloat(p, channel, op.precision);
+                    break;
+                }
+                default:
+                    p = WriteFloat(p, values[op.field], op.precision);
+                    break;
+            }
+        }
+        return p;
+    }
+
+    Program Build(std::string_view text) {
+        Program program;
+        Compile(program, text);
+        return program;
+    }
+}
+
+bool Template::Compile(Program& out, std::string_view text) {
+    Program program;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t brace = text.find_first_of("{}", pos);
+        if (brace == std::string_view::npos) {
+            AddLiteral(program, text.substr(pos));
+            break;
+        }
+        AddLiteral(program, text.substr(pos, brace - pos));
+
+        // "{{" and "}}" are a literal brace
+        if (brace + 1 < text.size() && text[brace + 1] == text[brace]) {
+            AddLiteral(program, text.substr(brace, 1));
+            pos = brace + 2;
+            continue;
+        }
+
+        size_t close = text[brace] == '{' ? text.find('}', brace) : std::string_view::npos;
+        if (close == std::string_view::npos) {
+            std::cerr << "Unmatched '" << text[brace] << "' in template!\n";
+            return false;
+        }
+        std::string_view spec = text.substr(brace + 1, close - brace - 1);
+        if (!AddField(program, spec)) {
+            std::cerr << "Unknown field '{" << spec << "}' in template!\n";
+            return false;
+        }
+        pos = close + 1;
+    }
+
+    out = std::move(program);
+    return true;
+}
+
+const Program& Template::ForFormat(Color::Format format) {
+    switch (format) {
+        case Color::Format::HEX: { static const Program program = Build("{hex}"); return program; }
+        case Color::Format::HSL: { static const Program program = Build("{h},{s},{l}"); return program; }
+        case Color::Format::CMYK: { static const Program program = Build("{c},{m},{y},{k}"); return program; }
+        case Color::Format::OKLAB: { static const Program program = Build("{ok.l},{ok.a},{ok.b}"); return program; }
+        case Color::Format::OKLCH: { static const Program program = Build("{ok.l},{ok.c},{ok.h}"); return program; }
+        case Color::Format::LAB: { static const Program program = Build("{lab.l},{lab.a},{lab.b}"); return program; }
+        default: break;
+    }
+    static const Program rgb = Build("{r},{g},{b}");
+    return rgb;
+}
+
+size_t Template::Format(char* buffer, const Program& program, const Color::RGB& color) {
+    Values values;
+    if (program.spaces & HSLSpace) {
+        Color::HSL hsl;
+        Color::RGBtoHSL(hsl, color);
+        SetHSL(values, hsl);
+    }
+    if (program.spaces & CMYKSpace) {
+        Color::CMYK cmyk;
+        Color::RGBtoCMYK(cmyk, color);
+        SetCMYK(values, cmyk);
+    }
+    if (program.spaces & OKLabSpace) {
+        Color::OKLab lab;
+        Color::RGBtoOKLab(lab, color);
+        SetOKLab(values, lab);
+    }
+    if (program.spaces & OKLCHSpace) {
+        Color::OKLCH lch;
+        Color::RGBtoOKLCH(lch, color);
+        SetOKLCH(values, lch);
+    }
+    if (program.spaces & LabSpace) {
+        Color::Lab lab;
+        Color::RGBtoLab(lab, color);
+        SetLab(values, lab);
+    }
+    return Emit(buffer, program, color, values) - buffer;
+}
+
+void Template::FormatLines(std::string& out, const Program& program, std::span<const Color::RGB> colors,
+                           const bool* valid) {
+    Color::HSL hsl[BatchSize];
+    Color::CMYK cmyk[BatchSize];
+    Color::OKLab oklab[BatchSize];
+    Color::OKLCH oklch[BatchSize];
+    Color::Lab lab[BatchSize];
+
+    for (size_t first = 0; first < colors.size(); first += BatchSize) {
+        size_t count = std::min(BatchSize, colors.size() - first);
+        std::span<const Color::RGB> in = colors.subspan(first, count);
+
+        // Convert every space the template uses for the whole batch first
+        if (program.spaces & HSLSpace) Color::RGBtoHSL(std::span(hsl, count), in);
+        if (program.spaces & CMYKSpace) Color::RGBtoCMYK(std::span(cmyk, count), in);
+        if (program.spaces & OKLabSpace) Color::RGBtoOKLab(std::span(oklab, count), in);
+        if (program.spaces & OKLCHSpace) Color::RGBtoOKLCH(std::span(oklch, count), in);
+        if (program.spaces & LabSpace) Color::RGBtoLab(std::span(lab, count), in);
+
+        // Write straight into the string, resized once for the worst case and trimmed after
+        size_t start = out.size();
+        out.resize(start + count * (program.maxSize + 1));
+        char* p = out.data() + start;
+        for (size_t i = 0; i < count; i++) {
+            if (valid && !valid[first + i]) {
+                *p++ = '\n';
+                continue;
+            }
+
+            Values values;
+            if (program.spaces & HSLSpace) SetHSL(values, hsl[i]);
+            if (program.spaces & CMYKSpace) SetCMYK(values, cmyk[i]);
+            if (program.spaces & OKLabSpace) SetOKLab(values, oklab[i]);
+            if (program.spaces & OKLCHSpace) SetOKLCH(values, oklch[i]);
+            if (program.spaces & LabSpace) SetLab(values, lab[i]);
+
+            p = Emit(p, program, in[i], values);
+            *p++ = '\n';
+        }
+        out.resize(p - out.data());
+    }
+}
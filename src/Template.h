@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Color.h"
+
+namespace Template {
+
+    /** Values a template can print. HSL and CMYK are in percent like the hsl and cmyk formats. */
+    enum class Field : uint8_t {
+        Literal,
+        R, G, B, Hex,
+        H, S, L, Degrees,
+        C, M, Y, K,
+        OkL, OkA, OkB, OkC, OkH,
+        LabL, LabA, LabB,
+    };
+
+    /** One step of a compiled template: a run of literal text or a field. */
+    struct Op {
+        Field field;
+        int8_t precision;       // Digits after the point, -1 for the shortest form (like std::ostream)
+        uint32_t offset;        // Literal text in Program::literals
+        uint32_t size;
+    };
+
+    /** A template parsed into the operations that print it, so colors are formatted without parsing it again. */
+    struct Program {
+        std::vector<Op> ops;
+        std::string literals;
+        unsigned spaces = 0;    // Color spaces the fields need, converted once per color
+        size_t maxSize = 0;     // Upper bound of chars one color takes
+    };
+
+    /** Compile a template like "rgb({r}, {g}, {b}) {hex} {h:.1}". Fields are written as {name} or {name:.N} for N
+    digits after the point, "{{" and "}}" print a brace. Fields:
+        r g b hex           RGB channels and "#RRGGBB"
+        h s l deg           HSL in percent, deg is the hue in degrees
+        c m y k             CMYK in percent
+        ok.l ok.a ok.b ok.c ok.h    OKLab and OKLCH (hue in degrees)
+        lab.l lab.a lab.b   CIELAB
+    Prints the problem to stderr and returns false if the template is invalid. */
+    bool Compile(Program& out, std::string_view text);
+
+    /** The compiled template of an output format: comma separated fields in the order of the format's name
+    ("{r},{g},{b}", "{h},{s},{l}", ...), or "{hex}" for hex. */
+    const Program& ForFormat(Color::Format format);
+
+    /** Format a color and return the number of chars written. buffer must hold at least program.maxSize chars. */
+    size_t Format(char* buffer, const Program& program, const Color::RGB& color);
+
+    /** Append colors to out, one per line. The color spaces the template needs are converted in batches.
+    Lines whose valid flag is false are left empty, valid may be null if all colors are valid. */
+    void FormatLines(std::string& out, const Program& program, std::span<const Color::RGB> colors,
+                     const bool* valid = nullptr);
+}
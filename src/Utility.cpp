@@ -4,23 +4,9 @@
 #include <sstream>
 #include <string>
 #include <unordered_map>
-
-void Utility::ZipStrings(std::string& buffer, const std::string& s1, const std::string& s2) {
-    std::istringstream ss1(s1);
-    std::istringstream ss2(s2);
-    std::ostringstream result;
-
-    std::string line1, line2;
-    bool firstLine = true;
-
-    while (std::getline(ss1, line1) && std::getline(ss2, line2)) {
-        if (!firstLine) result << '\n';
-        result << line1 << ' ' << line2;
-        firstLine = false;
-    }
-
-    buffer = result.str();
-}
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
 
 size_t Utility::CountLines(const std::string& str) {
     if (str.empty()) return 0;
@@ -35,6 +21,16 @@ size_t Utility::CountLines(const std::string& str) {
     return lines;
 }
 
+size_t Utility::MaxLineLength(std::string_view str) {
+    size_t longest = 0;
+    while (!str.empty()) {
+        size_t nl = str.find('\n');
+        longest = std::max(longest, std::min(nl, str.size()));
+        str.remove_prefix(nl == std::string_view::npos ? str.size() : nl + 1);
+    }
+    return longest;
+}
+
 std::unordered_map<std::string, std::string> Utility::ParseArgs(int argc, char* argv[]) {
     std::unordered_map<std::string, std::string> args;
 
@@ -91,10 +87,15 @@ bool Utility::StringToUint8(const std::string& str, uint8_t& out) {
     }
 }
 
-void Utility::CursorDown(std::ostream& stream, size_t lines) {
-    stream << "\033[" << lines << "B";
-}
-
-void Utility::CursorPos(std::ostream& stream, size_t row, size_t col) {
-    stream << "\033[" << row << ";" << col << "H";
+bool Utility::WriteAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
 }
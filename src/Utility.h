@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <cstdint>
 #include <vector>
@@ -8,17 +9,11 @@
 
 namespace Utility {
 
-    /** Concatenate two strings line by line. */
-    void ZipStrings(std::string& buffer, const std::string& s1, const std::string& s2);
-
     /** Count howmany lines a string has. */
     size_t CountLines(const std::string& str);
 
-    /** Move the cursor down n lines */
-    void CursorDown(std::ostream& stream, size_t lines);
-
-    /** Move the cursor to a specific row and column. */
-    void CursorPos(std::ostream& stream, size_t row, size_t col);
+    /** Length of the longest line of a string. */
+    size_t MaxLineLength(std::string_view str);
 
     /** Parse commandline arguments to be easyer to handle */
     std::unordered_map<std::string, std::string> ParseArgs(int argc, char* argv[]);
@@ -29,5 +24,8 @@ namespace Utility {
     /** Convert a string to uint8_t */
     bool StringToUint8(const std::string& str, uint8_t& out);
 
+    /** Write the whole buffer to a file descriptor, retrying on short writes. */
+    bool WriteAll(int fd, const char* data, size_t size);
+
 
 }
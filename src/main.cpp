@@ -2,29 +2,84 @@
 #include "Input.h"
 #include "Utility.h"
 #include "Color.h"
+#include "Contrast.h"
+#include "Convert.h"
+#include "Extract.h"
+#include "Gradient.h"
+#include "Cache.h"
+#include "Stats.h"
+#include "Parallel.h"
+#include "Palette.h"
+#include "Serve.h"
+#include "Template.h"
 
 #include <string>
 #include <iostream>
-#include <sstream>
 #include <vector>
-#include <iomanip>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
 
 #define VERSION "v1.1.0"
 
-enum class Format { RGB, HEX, CMYK, HSL };
+using Color::Format;
 
 struct AppState {
     Format format = Format::RGB;
+    Render::ShadeModel shadeModel = Render::ShadeModel::HSL;
+    Render::PixelMode pixelMode = Render::PixelMode::Half;  // How the maps pack pixels into cells
     int xSize = 25;
     int ySize = 25;
+    int requestedSize = 25;        // --size, the maps shrink below it when the window is too small
+    int fps = 60;                  // Upper limit of frames drawn per second
     Color::HSL hue = {0.0f, 1.0f, 1.0f};
-    int selectedX = 0;
+    int selectedX = 0;             // Selected pixel in the shown part of the shade map
     int selectedY = 0;
+    Cache::Viewport viewport{};    // Zoom level and the part of the magnified shade map that is shown
     bool running = true;
     bool wipeScreen = true;
+    bool fullRedraw = true;        // Set when the last frame on screen can not be diffed against
+    Render::CellGrid lastFrame{};  // Frame currently shown on the terminal
+    Render::CellGrid nextFrame{};  // Frame being composed, swapped with lastFrame so both keep their storage
+    Render::RenderBuffer huemap{}; // Hue bar with the current hue highlighted, reused so it keeps its capacity
+    Render::RenderBuffer swatch{}; // Selected color, reused like huemap
+    Render::RenderBuffer selectedCell{}; // Map cell holding the selection, reused like huemap
+    bool mouse = false;            // Mouse reporting is on and the frame position is queried
+    bool cursorQueried = false;    // The last frame asked for the cursor position, the input decoder has to expect the report
+    size_t originRow = 0;          // 1-based screen row of the line above the frame, 0 while unknown
+    bool syncOutput = false;       // Terminal supports synchronized output (DEC mode 2026)
+    std::string output;            // Frame output, reused so it keeps its capacity between frames
+    std::string info;              // Color info text, reused like output
+    size_t frameBytes = 0;         // Bytes written for the last frame
+    size_t totalBytes = 0;         // Bytes written for all frames
 };
 AppState state;
 
+// Named colors from --palette, shown in the color info
+Palette::Index palette;
+
+// How picked and converted colors are printed, --template or the one of --format
+Template::Program outputTemplate;
+
+// Per frame timings, only collected with --stats
+Stats::Recorder stats;
+
+// Shade maps for the current hue and its neighbours, filled ahead of time by a worker thread
+Cache::MapCache mapCache(32);
+
+constexpr float HueStep = 0.01f;
+constexpr int PrefetchSteps = 2;   // Hues prefetched on either side of the current one
+constexpr size_t HueBarWidth = 4;  // Pixels
+constexpr unsigned MaxZoom = 6;    // The shade map is magnified up to 2^MaxZoom times
+
+// Frames are wrapped in these when the terminal supports them, so it paints the whole frame at once
+constexpr size_t SyncOutputMode = 2026;
+constexpr std::string_view SyncBegin = "\033[?2026h";
+constexpr std::string_view SyncEnd = "\033[?2026l";
+
 // -------------------------------------------------------------
 // CLI HELPERS
 // -------------------------------------------------------------
@@ -38,6 +93,30 @@ void printUsage() {
         "    -s, --size={num}    Number of pixels for width and height.\n"
         "    -f, --format={str}  Set output format. (Default: 'rgb')\n"
         "    -W, --no-wipe       Leave color picker displayed at exit\n"
+        "        --fps={num}     Maximum redraws per second. (Default: 60)\n"
+        "        --shade={str}   Color model of the shade map: hsl or oklch. (Default: 'hsl')\n"
+        "        --pixels={str}  Pixels per cell of the maps. (Default: 'half')\n"
+        "        --palette={file} Named colors (\"#RRGGBB name\" or \"R G B name\" per line).\n"
+        "        --nearest={color} Print the palette color nearest to a color and exit.\n"
+        "        --color-mode={str} Colors sent to the terminal. (Default: 'truecolor')\n"
+        "        --threads={num} Threads for large maps. (Default: one per core)\n"
+        "        --stats[={file}] Print frame timings to stderr (or a file) on exit.\n"
+        "    -c, --convert[={file}] Convert newline separated colors from a file or stdin.\n"
+        "        --from={str}    Input format for --convert and --gradient. (Default: '--format')\n"
+        "        --to={str}      Output format for --convert. (Default: '--format')\n"
+        "        --template={str} Print colors like 'rgb({r}, {g}, {b}) {hex} {h:.1}' instead of '--format'.\n"
+        "        --extract={file} Print the dominant colors of a PPM, PGM or PAM image.\n"
+        "        --count={num}   Number of colors for --extract. (Default: 8)\n"
+        "        --contrast={file} Print contrast ratio and CIEDE2000 of every pair of colors in a palette.\n"
+        "        --min-ratio={num} Contrast ratio a --contrast pair needs to pass. (Default: 4.5)\n"
+        "        --min-delta={num} CIEDE2000 difference a --contrast pair needs to pass. (Default: 0)\n"
+        "        --only={str}    Print only the --contrast pairs that pass or fail.\n"
+        "        --gradient={from},{to}[,{color}...] Print the steps of a gradient through these colors.\n"
+        "        --steps={num}   Number of steps for --gradient. (Default: 10)\n"
+        "        --space={str}   Space --gradient interpolates in. (Default: 'oklab')\n"
+        "        --preview       Draw the gradient to stderr as well.\n"
+        "        --serve[={socket}] Answer requests on a Unix socket until interrupted.\n"
+        "        --client[={socket}] Send request lines from stdin to a --serve server.\n"
         "\n"
         "Example runs:\n"
         "  Run clid in normal mode; choose a color and receive it on stdout on quit\n"
@@ -48,10 +127,32 @@ void printUsage() {
         "    $ ./clid --format=hex | wl-copy            # For wayland\n"
         "    $ ./clid --format=hex | xsel -i -b         # For X11\n"
         "    $ ./clid --format=hex | xclip -i -sel clip # For X11\n"
+        "  Find the name of a color\n"
+        "    $ clid --palette=/usr/share/X11/rgb.txt --format=hex --nearest=#ff6347\n"
+        "  Get a 5 color palette from an image\n"
+        "    $ clid --extract=photo.ppm --count=5 --format=hex\n"
+        "  List the pairs of a palette that fail WCAG AA contrast\n"
+        "    $ clid --contrast=brand-colors.txt --only=fail --format=hex\n"
+        "  Print a 16 step ramp from red to blue\n"
+        "    $ clid --gradient=#ff0000,#0000ff --steps=16 --format=hex --preview\n"
+        "  Convert a list of hex colors to hsl\n"
+        "    $ clid --convert=colors.txt --from=hex --to=hsl\n"
+        "  Print the picked color as CSS\n"
+        "    $ clid --template='rgb({r} {g} {b})'\n"
+        "  Keep a server running and convert through it without starting clid per color\n"
+        "    $ clid --serve --palette=/usr/share/X11/rgb.txt &\n"
+        "    $ echo 'convert hex hsl #ff6347' | clid --client\n"
         "  Capture output into a variable\n"
         "    $ color=$(./clid)     # Can add options like (./clid -W)\n"
         "\n"
-        "OUTPUT FORMATS: rgb, hex, cmyk, hsl\n"
+        "OUTPUT FORMATS: rgb, hex, cmyk, hsl, oklab, oklch, lab\n"
+        "GRADIENT SPACES: rgb, hsl, oklab, oklch\n"
+        "TEMPLATE FIELDS: {r} {g} {b} {hex}, {h} {s} {l} {deg}, {c} {m} {y} {k}, {ok.l} {ok.a} {ok.b} {ok.c} {ok.h},\n"
+        "    {lab.l} {lab.a} {lab.b}. Add :.N for N digits after the point ({h:.1}), {{ and }} print a brace.\n"
+        "SERVER REQUESTS (one per line, one response line each):\n"
+        "    convert {from} {to} {color}, nearest {from} {to} {color}, preview {from} {color}, stats\n"
+        "PIXEL MODES: half (1x2), quadrant (2x2), sextant (2x3), braille (2x4)\n"
+        "COLOR MODES: truecolor, 256, 16, auto (from $COLORTERM and $TERM, which ssh, sudo and tmux often drop)\n"
         "\n"
         "TUI CONTROLS:\n"
         "    j  Move hue selector up.\n"
@@ -60,14 +161,26 @@ void printUsage() {
         "    a  Move shade selector left.\n"
         "    s  Move shade selector down.\n"
         "    d  Move shade selector right.\n"
-        "    q  Exit\n";
+        "    +  Zoom into the shade map around the selector, - zooms out. The map pans at its edges.\n"
+        "    q  Exit\n"
+        "    Arrow keys move the shade selector, PageUp/PageDown the hue selector.\n"
+        "    Click or drag on the shade map or hue bar to jump there.\n";
+}
+
+bool parseSpace(const std::string& str, Gradient::Space& out) {
+    if (str == "rgb") out = Gradient::Space::RGB;
+    else if (str == "hsl") out = Gradient::Space::HSL;
+    else if (str == "oklab") out = Gradient::Space::OKLAB;
+    else if (str == "oklch") out = Gradient::Space::OKLCH;
+    else return false;
+    return true;
 }
 
-bool parseFormat(const std::string& str, Format& out) {
-    if (str == "rgb") out = Format::RGB;
-    else if (str == "hex") out = Format::HEX;
-    else if (str == "cmyk") out = Format::CMYK;
-    else if (str == "hsl") out = Format::HSL;
+bool parseColorMode(const std::string& str, Color::Mode& out) {
+    if (str == "truecolor") out = Color::Mode::TrueColor;
+    else if (str == "256") out = Color::Mode::Indexed256;
+    else if (str == "16") out = Color::Mode::Indexed16;
+    else if (str == "auto") out = Color::DetectMode(std::getenv("COLORTERM"), std::getenv("TERM"));
     else return false;
     return true;
 }
@@ -75,29 +188,38 @@ bool parseFormat(const std::string& str, Format& out) {
 // -------------------------------------------------------------
 // COLOR INFO GENERATOR
 // -------------------------------------------------------------
-std::string makeColorInfo(const Color::RGB& rgb) {
-    std::ostringstream oss;
-
-    // RGB
-    oss << "RGB: " << (int)rgb.r << " " << (int)rgb.g << " " << (int)rgb.b << "\n";
-
-    // HEX
-    Color::HEX hexColor;
-    Color::RGBtoHEX(hexColor, rgb);
-    oss << "HEX: " << hexColor << "\n";
-
-    // HSL
-    Color::HSL hsl;
-    Color::RGBtoHSL(hsl, rgb);
-    oss << std::fixed << std::setprecision(2);
-    oss << "HSL: " << hsl.h * 100.0f << " " << hsl.s * 100.0f << " " << hsl.l * 100.0f << "\n";
-
-    // CMYK
-    Color::CMYK cmyk;
-    Color::RGBtoCMYK(cmyk, rgb);
-    oss << "CMYK: " << cmyk.c * 100.0f << " " << cmyk.m * 100.0f << " " << cmyk.y * 100.0f << " " << cmyk.k;
+/** Write the color info shown next to the swatch into out, which keeps its capacity between calls. */
+void makeColorInfo(std::string& out, const Color::RGB& rgb) {
+    static const Template::Program info = [] {
+        Template::Program program;
+        Template::Compile(program,
+            "RGB: {r} {g} {b}\n"
+            "HEX: {hex}\n"
+            "HSL: {h:.2} {s:.2} {l:.2}\n"
+            "CMYK: {c:.2} {m:.2} {y:.2} {k:.2}");
+        return program;
+    }();
+
+    out.resize(info.maxSize);
+    out.resize(Template::Format(out.data(), info, rgb));
+
+    // WCAG contrast against white and black text
+    float luminance = Contrast::Luminance(rgb);
+    out += "\nContrast: ";
+    for (float against : {1.0f, 0.0f}) {
+        char number[16];
+        auto [end, ec] = std::to_chars(number, number + sizeof(number), Contrast::Ratio(luminance, against),
+            std::chars_format::fixed, 2);
+        out.append(number, ec == std::errc() ? end : number);
+        out += against > 0.0f ? ":1 white, " : ":1 black";
+    }
 
-    return oss.str();
+    // Nearest palette name
+    Palette::Match match;
+    if (palette.Nearest(rgb, match)) {
+        out += "\nName: ";
+        out += match.name;
+    }
 }
 
 // -------------------------------------------------------------
@@ -110,27 +232,90 @@ void viewColor(const Color::RGB& color) {
 
     Render::Fill(colorView, color);
 
-    std::string colorViewStr;
-    Render::RenderANSIString(colorViewStr, colorView);
+    std::string& info = state.info;
+    makeColorInfo(info, color);
 
-    std::string info = makeColorInfo(color);
+    // Color swatch with the info text one column to its right
+    Render::CellGrid grid;
+    Render::Clear(grid, colorView.width + 1 + Utility::MaxLineLength(info), std::max(colorView.height / 2, Utility::CountLines(info)));
+    Render::BlitPixels(grid, Render::View(colorView), 0, 0);
+    Render::BlitText(grid, info, colorView.width + 1, 0);
 
     std::string out;
-    Utility::ZipStrings(out, colorViewStr, info);
-    std::cerr << out << "\n";
+    Render::RenderCells(out, grid);
+    std::cerr << out;
 }
 
 // -------------------------------------------------------------
 // INPUT HANDLER
 // -------------------------------------------------------------
+/** Move a hue by a number of selector steps, the same way repeated key presses do. */
+float stepHue(float hue, int steps) {
+    for (; steps > 0; steps--) hue = std::min(1.0f, hue + HueStep);
+    for (; steps < 0; steps++) hue = std::max(0.0f, hue - HueStep);
+    return hue;
+}
+
+/** Keep the viewport inside the magnified shade map, e.g. after the window shrank or grew. */
+void clampViewport() {
+    Cache::Viewport& view = state.viewport;
+    view.x = std::min(view.x, (static_cast<size_t>(state.xSize) << view.zoom) - state.xSize);
+    view.y = std::min(view.y, (static_cast<size_t>(state.ySize) << view.zoom) - state.ySize);
+}
+
+/** Magnify the shade map twice as much (levels > 0) or half as much, keeping the selected shade under the cursor
+where the edges of the map allow it. */
+void zoom(int levels) {
+    Cache::Viewport& view = state.viewport;
+    unsigned level = static_cast<unsigned>(std::clamp(static_cast<int>(view.zoom) + levels, 0, static_cast<int>(MaxZoom)));
+    if (level == view.zoom) return;
+
+    size_t x = view.x + state.selectedX, y = view.y + state.selectedY;
+    if (level > view.zoom) {
+        x <<= level - view.zoom;
+        y <<= level - view.zoom;
+    } else {
+        x >>= view.zoom - level;
+        y >>= view.zoom - level;
+    }
+
+    view.zoom = level;
+    view.x = x - std::min<size_t>(x, state.selectedX);
+    view.y = y - std::min<size_t>(y, state.selectedY);
+    clampViewport();
+    state.selectedX = static_cast<int>(x - view.x);
+    state.selectedY = static_cast<int>(y - view.y);
+}
+
+/** Move the selection by one pixel. At the edge of a magnified map's view the view pans instead. */
+void moveSelection(int dx, int dy) {
+    Cache::Viewport& view = state.viewport;
+    size_t maxX = (static_cast<size_t>(state.xSize) << view.zoom) - state.xSize;
+    size_t maxY = (static_cast<size_t>(state.ySize) << view.zoom) - state.ySize;
+
+    int x = state.selectedX + dx, y = state.selectedY + dy;
+    if (x < 0 && view.x > 0) view.x--;
+    else if (x >= state.xSize && view.x < maxX) view.x++;
+    if (y < 0 && view.y > 0) view.y--;
+    else if (y >= state.ySize && view.y < maxY) view.y++;
+
+    state.selectedX = std::clamp(x, 0, state.xSize - 1);
+    state.selectedY = std::clamp(y, 0, state.ySize - 1);
+}
+
 void handleInput(char& key) {
+    if (!state.running) return; // Keys queued behind a quit are dropped
+
     switch (key) {
-        case 'k': state.hue.h = std::min(1.0f, state.hue.h + 0.01f); break;
-        case 'j': state.hue.h = std::max(0.0f, state.hue.h - 0.01f); break;
-        case 'w': state.selectedY = std::max(0, state.selectedY - 1); break;
-        case 'a': state.selectedX = std::max(0, state.selectedX - 1); break;
-        case 's': state.selectedY = std::min(state.ySize - 1, state.selectedY + 1); break;
-        case 'd': state.selectedX = std::min(state.xSize - 1, state.selectedX + 1); break;
+        case 'k': state.hue.h = stepHue(state.hue.h, 1); break;
+        case 'j': state.hue.h = stepHue(state.hue.h, -1); break;
+        case 'w': moveSelection(0, -1); break;
+        case 'a': moveSelection(-1, 0); break;
+        case 's': moveSelection(0, 1); break;
+        case 'd': moveSelection(1, 0); break;
+        case '+':
+        case '=': zoom(1); break;
+        case '-': zoom(-1); break;
         case 'q':
         case '\n':
             state.running = false; 
@@ -138,56 +323,140 @@ void handleInput(char& key) {
     }
 }
 
+void handleKey(Input::Key key) {
+    char mapped;
+    switch (key) {
+        case Input::Key::Up: mapped = 'w'; break;
+        case Input::Key::Down: mapped = 's'; break;
+        case Input::Key::Left: mapped = 'a'; break;
+        case Input::Key::Right: mapped = 'd'; break;
+        case Input::Key::PageUp: mapped = 'k'; break;
+        case Input::Key::PageDown: mapped = 'j'; break;
+        default: return;
+    }
+    handleInput(mapped);
+}
+
+void handleCursor(size_t row, size_t) {
+    state.originRow = row;
+}
+
+void handleMouse(const Input::MouseEvent& event) {
+    if (!state.running || state.originRow == 0) return;
+    if (event.button != 0 || event.action == Input::MouseAction::Release) return;
+    if (event.row <= state.originRow || event.col == 0) return;
+
+    // Every cell of the maps holds a block of pixels, a click picks the upper left one
+    size_t row = event.row - state.originRow - 1;
+    size_t col = event.col - 1;
+    size_t pixelRow = row * Render::CellHeight(state.pixelMode);
+    if (pixelRow >= static_cast<size_t>(state.ySize)) return;
+
+    size_t mapCols = Render::CellsAcross(state.xSize, state.pixelMode);
+    size_t hueCol = mapCols + 1;
+    if (col < mapCols) {
+        state.selectedX = static_cast<int>(col * Render::CellWidth(state.pixelMode));
+        state.selectedY = static_cast<int>(pixelRow);
+    } else if (col >= hueCol && col < hueCol + Render::CellsAcross(HueBarWidth, state.pixelMode)) {
+        state.hue.h = std::min(1.0f, static_cast<float>(pixelRow) / state.ySize);
+    }
+}
+
+void handleMode(size_t mode, size_t value) {
+    // 1 and 2 are set and reset, 3 and 4 their permanent variants; 0 means the mode is unknown
+    if (mode == SyncOutputMode) state.syncOutput = value >= 1 && value <= 3;
+}
+
+/** Shrink the maps so the whole picker fits into the terminal window, but never beyond --size. */
+void fitToWindow(const Input::Terminal& terminal) {
+    size_t cols, rows;
+    if (!terminal.windowSize(cols, rows)) return;
+
+    // Hue bar and its gap take 5 columns (3 with two pixels per column). Below the maps go the swatch (4 rows)
+    // or the color info next to it if that is longer, the help line and the leading newline
+    makeColorInfo(state.info, Color::RGB{});
+    int swatchRows = std::max(4, static_cast<int>(Utility::CountLines(state.info)));
+    int cellWidth = static_cast<int>(Render::CellWidth(state.pixelMode));
+    int cellHeight = static_cast<int>(Render::CellHeight(state.pixelMode));
+    int hueCols = static_cast<int>(Render::CellsAcross(HueBarWidth, state.pixelMode)) + 1;
+    int fitX = (static_cast<int>(cols) - hueCols) * cellWidth;
+    int fitY = (static_cast<int>(rows) - swatchRows - 2) * cellHeight;
+    state.xSize = std::max(2, std::min(state.requestedSize, fitX));
+    state.ySize = std::max(2, std::min(state.requestedSize, fitY));
+
+    state.selectedX = std::min(state.selectedX, state.xSize - 1);
+    state.selectedY = std::min(state.selectedY, state.ySize - 1);
+    clampViewport();
+}
+
 // -------------------------------------------------------------
 // DRAW LOOP
 // -------------------------------------------------------------
-std::string drawUI() {
-    Render::RenderBuffer shademap;
-    shademap.width = state.xSize;
-    shademap.height = state.ySize;
+size_t drawUI() {
+    stats.beginFrame();
 
-    Render::RenderBuffer huemap;
-    huemap.width = 4;
-    huemap.height = state.ySize;
+    auto shademap = mapCache.GetShadeMap(state.hue.h, state.xSize, state.ySize, state.viewport);
+    const Cache::HueMap& cachedHuemap = mapCache.GetHueMap(HueBarWidth, state.ySize);
 
-    Render::RenderBuffer colordisplay;
+    // Let the worker generate the maps a few key presses away while this frame is drawn
+    std::array<float, 2 * PrefetchSteps> neighbours;
+    for (int step = 1; step <= PrefetchSteps; step++) {
+        neighbours[2 * step - 2] = stepHue(state.hue.h, step);
+        neighbours[2 * step - 1] = stepHue(state.hue.h, -step);
+    }
+    mapCache.Prefetch(neighbours, state.xSize, state.ySize, state.viewport);
+    stats.mark(Stats::Phase::Generate);
+
+    // Assigning copies into the storage of the last frame's hue bar
+    Render::RenderBuffer& huemap = state.huemap;
+    huemap = cachedHuemap.pixels;
+
+    Render::RenderBuffer& colordisplay = state.swatch;
     colordisplay.width = 4;
     colordisplay.height = 8;
 
-    Render::GenerateShadeMap(shademap, state.hue.h);
-    Render::GenerateHueMap(huemap);
-
-    Color::RGB selectedColor = shademap.pixelMatrix[state.selectedY][state.selectedX];
+    Color::RGB selectedColor = Render::At(shademap->pixels, state.selectedX, state.selectedY);
     Render::Fill(colordisplay, selectedColor);
 
     // Highlight hue
     size_t l = 0;
     bool highlighted = false;
+    const std::vector<float>& rowHues = cachedHuemap.rowHues;
     while (l < huemap.height - 1) {
-        Color::HSL h1, h2;
-        Color::RGBtoHSL(h1, huemap.pixelMatrix[l][0]);
-        Color::RGBtoHSL(h2, huemap.pixelMatrix[l + 1][0]);
-        if ((state.hue.h >= h1.h && state.hue.h <= h2.h) ||
-            (state.hue.h >= h2.h && state.hue.h <= h1.h)) {
-            std::vector<Render::Pixel> row(huemap.width);
-            for (auto& px : row) Color::HSLtoRGB(px, {h1.h, 0.4f, 0.4f});
-            huemap.pixelMatrix[l] = row;
+        float h1 = rowHues[l], h2 = rowHues[l + 1];
+        if ((state.hue.h >= h1 && state.hue.h <= h2) ||
+            (state.hue.h >= h2 && state.hue.h <= h1)) {
+            Render::Pixel px;
+            Color::HSLtoRGB(px, {h1, 0.4f, 0.4f});
+            Render::Fill(Render::View(huemap, 0, l, huemap.width, 1), px);
             highlighted = true;
             break;
         }
         ++l;
     }
     if (!highlighted) {
-        Color::HSL lastHue;
-        Color::RGBtoHSL(lastHue, huemap.pixelMatrix.back()[0]);
-        std::vector<Render::Pixel> row(huemap.width);
-        for (auto& px : row) Color::HSLtoRGB(px, {lastHue.h, 0.3f, 0.3f});
-        huemap.pixelMatrix.back() = row;
+        Render::Pixel px;
+        Color::HSLtoRGB(px, {rowHues.back(), 0.3f, 0.3f});
+        Render::Fill(Render::View(huemap, 0, huemap.height - 1, huemap.width, 1), px);
     }
 
-    // Highlight selected shade
+    // Highlight selected shade: re-pack the cell holding it from its pixels, the selected one inverted
+    Render::RenderBuffer& selectedCell = state.selectedCell;
+    size_t cellWidth = Render::CellWidth(state.pixelMode), cellHeight = Render::CellHeight(state.pixelMode);
+    size_t left = state.selectedX - state.selectedX % cellWidth;
+    size_t top = state.selectedY - state.selectedY % cellHeight;
     {
-        Color::RGB current = shademap.pixelMatrix[state.selectedY][state.selectedX];
+        selectedCell.width = std::min<size_t>(cellWidth, state.xSize - left);
+        selectedCell.height = std::min<size_t>(cellHeight, state.ySize - top);
+        selectedCell.mode = state.pixelMode;
+        selectedCell.pixels.resize(selectedCell.width * selectedCell.height);
+        for (size_t y = 0; y < selectedCell.height; y++) {
+            for (size_t x = 0; x < selectedCell.width; x++) {
+                Render::At(selectedCell, x, y) = Render::At(shademap->pixels, left + x, top + y);
+            }
+        }
+
+        Color::RGB& current = Render::At(selectedCell, state.selectedX - left, state.selectedY - top);
 
         Color::RGB inverted = {
             static_cast<uint8_t>(255 - current.r),
@@ -195,31 +464,70 @@ std::string drawUI() {
             static_cast<uint8_t>(255 - current.b)
         };
 
-        shademap.pixelMatrix[state.selectedY][state.selectedX] = inverted;
+        current = inverted;
     }
+    stats.mark(Stats::Phase::Highlight);
+
+    std::string& info = state.info;
+    makeColorInfo(info, selectedColor);
+    const std::string_view help = "(jk) Hue, (ws) Brightness, (ad) Saturation, (+-) Zoom, (q/ENTER) Done";
+
+    // Compose the frame: maps side by side, swatch with info below them and the help line last
+    size_t mapRows = shademap->cells.height;
+    size_t swatchRows = std::max(colordisplay.height / 2, Utility::CountLines(info));
+    size_t width = std::max({
+        shademap->cells.width + 1 + Render::CellsAcross(huemap.width, huemap.mode),
+        colordisplay.width + 1 + Utility::MaxLineLength(info),
+        help.size()
+    });
+
+    Render::CellGrid& frame = state.nextFrame;
+    Render::Clear(frame, width, mapRows + swatchRows + 1);
+    Render::BlitCells(frame, shademap->cells, 0, 0);
+    Render::BlitPixels(frame, Render::View(selectedCell), left / cellWidth, top / cellHeight);
+    Render::BlitPixels(frame, Render::View(huemap), shademap->cells.width + 1, 0);
+    Render::BlitPixels(frame, Render::View(colordisplay), 0, mapRows);
+    Render::BlitText(frame, info, colordisplay.width + 1, mapRows);
+    Render::BlitText(frame, help, 0, mapRows + swatchRows, {128, 128, 128});
+    stats.mark(Stats::Phase::Compose);
+
+    // Only send the cells that changed since the last frame, unless a full redraw is due.
+    // The frame is assembled in one buffer so it reaches the terminal with a single write.
+    std::string& display = state.output;
+    display.clear();
+    if (state.syncOutput) display += SyncBegin;
+    display += "\n";
+    Render::EncodeStats encoded{};
+    Render::EncodeStats* encodeStats = stats.isEnabled() ? &encoded : nullptr;
+    bool full = state.fullRedraw || !Render::RenderDiff(display, state.lastFrame, frame, encodeStats);
+    if (!full) {
+        display += "\033[A";
+    } else {
+        // Erase leftovers below a frame that was taller before, e.g. after a resize
+        if (!state.lastFrame.cells.empty()) display += "\033[J";
+        Render::RenderCells(display, frame, !state.lastFrame.cells.empty(), encodeStats);
 
-    // Convert to strings
-    std::string shademapStr, huemapStr, colordisplayStr;
-    Render::RenderANSIString(shademapStr, shademap);
-    Render::RenderANSIString(huemapStr, huemap);
-    Render::RenderANSIString(colordisplayStr, colordisplay);
-
-    std::string info = makeColorInfo(selectedColor);
-
-    std::string colorInfoBuffer;
-    Utility::ZipStrings(colorInfoBuffer, colordisplayStr, info);
-
-    std::string display;
-    Utility::ZipStrings(display, shademapStr, huemapStr);
-    display += "\n" + colorInfoBuffer;
-    display += "\n\033[38;2;128;128;128m(jk) Hue, (ws) Brightness, (ad) Saturation, (q/ENTER) Done\033[0m";
-
-    std::cerr << "\n" << display << std::endl;
+        // Move cursor up to overwrite
+        display += "\r\033[" + std::to_string(frame.height + 1) + "A";
 
-    // Move cursor up to overwrite
-    size_t lines = Utility::CountLines(display) + 1;
-    std::cerr << "\r\033[" + std::to_string(lines) + "A";
-    return display;
+        // The frame may have scrolled the screen, ask where it starts so mouse reports can be mapped to it
+        if (state.mouse) {
+            display += "\033[6n";
+            state.cursorQueried = true;
+        }
+    }
+    if (state.syncOutput) display += SyncEnd;
+    stats.mark(Stats::Phase::Encode);
+
+    Utility::WriteAll(STDERR_FILENO, display.data(), display.size());
+    stats.mark(Stats::Phase::Write);
+
+    state.frameBytes = display.size();
+    state.totalBytes += display.size();
+    state.fullRedraw = false;
+    stats.endFrame(display.size(), encoded, full);
+    std::swap(state.lastFrame, frame);
+    return state.lastFrame.height;
 }
 
 // -------------------------------------------------------------
@@ -228,7 +536,7 @@ std::string drawUI() {
 int main(int argc, char* argv[]) {
     auto args = Utility::ParseArgs(argc, argv);
 
-    const std::vector<std::string> acceptedArgs = {"help", "h", "version", "V", "format", "f", "size", "s", "view", "v", "no-wipe", "W"};
+    const std::vector<std::string> acceptedArgs = {"help", "h", "version", "V", "format", "f", "size", "s", "view", "v", "no-wipe", "W", "convert", "c", "from", "to", "fps", "stats", "threads", "color-mode", "palette", "nearest", "shade", "extract", "count", "contrast", "min-ratio", "min-delta", "only", "gradient", "steps", "space", "preview", "template", "serve", "client", "pixels"};
 
     // Check for unknown arguments
     for (const auto& arg : args) {
@@ -251,21 +559,177 @@ int main(int argc, char* argv[]) {
     if (args.count("version") || args.count("V")) { std::cout << "Version: clid " << VERSION << "\n"; return 0; }
     if (args.count("format") || args.count("f")) {
         std::string formatStr = args.count("format") ? args["format"] : args["f"];
-        if (!parseFormat(formatStr, state.format)) {
+        if (!Convert::ParseFormat(formatStr, state.format)) {
             std::cerr << "Invalid format for --format!\n";
             printUsage();
             return 1;
         }
     }
+    if (args.count("template")) {
+        if (!Template::Compile(outputTemplate, args["template"])) return 1;
+    } else {
+        outputTemplate = Template::ForFormat(state.format);
+    }
     if (args.count("size") || args.count("s")) {
         std::string sizeStr = args.count("size") ? args["size"] : args["s"];
-        state.xSize = state.ySize = std::stoi(sizeStr);
+        state.xSize = state.ySize = state.requestedSize = std::stoi(sizeStr);
+    }
+    if (args.count("fps")) {
+        state.fps = std::atoi(args["fps"].c_str());
+        if (state.fps <= 0) {
+            std::cerr << "Invalid value for --fps!\n";
+            return 1;
+        }
+    }
+
+    Color::Mode colorMode;
+    if (!parseColorMode(args.count("color-mode") ? args["color-mode"] : "truecolor", colorMode)) {
+        std::cerr << "Invalid value for --color-mode!\n";
+        printUsage();
+        return 1;
+    }
+    Render::SetColorMode(colorMode);
+
+    if (args.count("shade")) {
+        if (args["shade"] == "hsl") state.shadeModel = Render::ShadeModel::HSL;
+        else if (args["shade"] == "oklch") state.shadeModel = Render::ShadeModel::OKLCH;
+        else {
+            std::cerr << "Invalid value for --shade!\n";
+            return 1;
+        }
+        mapCache.SetModel(state.shadeModel);
+    }
+
+    if (args.count("pixels")) {
+        if (args["pixels"] == "half") state.pixelMode = Render::PixelMode::Half;
+        else if (args["pixels"] == "quadrant") state.pixelMode = Render::PixelMode::Quadrant;
+        else if (args["pixels"] == "sextant") state.pixelMode = Render::PixelMode::Sextant;
+        else if (args["pixels"] == "braille") state.pixelMode = Render::PixelMode::Braille;
+        else {
+            std::cerr << "Invalid value for --pixels!\n";
+            printUsage();
+            return 1;
+        }
+        mapCache.SetPixelMode(state.pixelMode);
+    }
+
+    if (args.count("threads")) {
+        int threads = std::atoi(args["threads"].c_str());
+        if (threads <= 0) {
+            std::cerr << "Invalid value for --threads!\n";
+            return 1;
+        }
+        Parallel::SetThreads(threads);
     }
 
     if (args.count("no-wipe") || args.count("W")) {
         state.wipeScreen = false;
     }
 
+    // Bulk conversion mode
+    if (args.count("convert") || args.count("c")) {
+        std::string path = args.count("convert") ? args["convert"] : args["c"];
+        Format from = state.format, to = state.format;
+        if ((args.count("from") && !Convert::ParseFormat(args["from"], from)) ||
+            (args.count("to") && !Convert::ParseFormat(args["to"], to))) {
+            std::cerr << "Invalid format for --from/--to!\n";
+            return 1;
+        }
+        return Convert::Run(path, from, args.count("template") ? outputTemplate : Template::ForFormat(to)) ? 0 : 1;
+    }
+
+    // Gradient mode
+    if (args.count("gradient")) {
+        Format from = state.format;
+        if (args.count("from") && !Convert::ParseFormat(args["from"], from)) {
+            std::cerr << "Invalid format for --from!\n";
+            return 1;
+        }
+        std::vector<Color::RGB> stops;
+        if (!Gradient::ParseStops(stops, args["gradient"], from)) {
+            std::cerr << "Invalid colors for --gradient, at least two are needed!\n";
+            return 1;
+        }
+        Gradient::Space space = Gradient::Space::OKLAB;
+        if (args.count("space") && !parseSpace(args["space"], space)) {
+            std::cerr << "Invalid value for --space!\n";
+            printUsage();
+            return 1;
+        }
+        long long steps = args.count("steps") ? std::atoll(args["steps"].c_str()) : 10;
+        if (steps <= 0) {
+            std::cerr << "Invalid value for --steps!\n";
+            return 1;
+        }
+        return Gradient::Run(stops, static_cast<size_t>(steps), space, outputTemplate, args.count("preview")) ? 0 : 1;
+    }
+
+    // Palette extraction mode
+    if (args.count("extract")) {
+        int count = args.count("count") ? std::atoi(args["count"].c_str()) : 8;
+        if (count <= 0) {
+            std::cerr << "Invalid value for --count!\n";
+            return 1;
+        }
+        return Extract::Run(args["extract"], static_cast<size_t>(count), outputTemplate) ? 0 : 1;
+    }
+
+    // Contrast audit of a palette
+    if (args.count("contrast")) {
+        Contrast::Options options;
+        if (args.count("min-ratio")) options.minRatio = std::strtof(args["min-ratio"].c_str(), nullptr);
+        if (args.count("min-delta")) options.minDeltaE = std::strtof(args["min-delta"].c_str(), nullptr);
+        if (options.minRatio < 1.0f || options.minDeltaE < 0.0f) {
+            std::cerr << "Invalid value for --min-ratio/--min-delta!\n";
+            return 1;
+        }
+        if (args.count("only")) {
+            if (args["only"] == "pass") options.filter = Contrast::Filter::Pass;
+            else if (args["only"] == "fail") options.filter = Contrast::Filter::Fail;
+            else {
+                std::cerr << "Invalid value for --only!\n";
+                printUsage();
+                return 1;
+            }
+        }
+        return Contrast::Run(args["contrast"], options, outputTemplate) ? 0 : 1;
+    }
+
+    if (args.count("palette") && !palette.Load(args["palette"])) return 1;
+
+    // Daemon mode and its client
+    if (args.count("client")) {
+        return Serve::Client(args["client"].empty() ? Serve::DefaultPath() : args["client"]) ? 0 : 1;
+    }
+    if (args.count("serve")) {
+        Stats::RequestRecorder requests;
+        if (args.count("stats")) requests.enable();
+        bool ok = Serve::Run(args["serve"].empty() ? Serve::DefaultPath() : args["serve"], palette, requests);
+        if (requests.isEnabled() && !requests.writeReport(args["stats"])) {
+            std::cerr << "Could not write stats to '" << args["stats"] << "'!\n";
+            return 1;
+        }
+        return ok ? 0 : 1;
+    }
+
+    // Nearest named color
+    if (args.count("nearest")) {
+        Color::RGB rgb;
+        if (!Convert::ParseColor(rgb, args["nearest"], state.format)) {
+            std::cerr << "Invalid color for --nearest!\n";
+            return 1;
+        }
+        Palette::Match match;
+        if (!palette.Nearest(rgb, match)) {
+            std::cerr << "--nearest needs a non-empty --palette!\n";
+            return 1;
+        }
+        std::string formatted(outputTemplate.maxSize, '\0');
+        formatted.resize(Template::Format(formatted.data(), outputTemplate, match.rgb));
+        std::cout << formatted << " " << match.name << "\n";
+        return 0;
+    }
+
     // View mode
     if (args.count("view") || args.count("v")) {
         std::string viewStr = args.count("view") ? args["view"] : args["v"];
@@ -283,7 +747,7 @@ int main(int argc, char* argv[]) {
                 break;
             }
             case Format::HEX:
-                if (!Color::HEXtoRGB(rgb, viewStr)) {
+                if (!Color::DecodeHEX(rgb, viewStr)) {
                     std::cerr << "Invalid HEX value for --view!\n";
                     return 1;
                 }
@@ -315,63 +779,110 @@ int main(int argc, char* argv[]) {
                 Color::CMYKtoRGB(rgb, cmyk);
                 break;
             }
+            case Format::OKLAB:
+            case Format::OKLCH:
+            case Format::LAB:
+                if (!Convert::ParseColor(rgb, viewStr, state.format)) {
+                    std::cerr << "Invalid color for --view!\n";
+                    return 1;
+                }
+                break;
         }
         viewColor(rgb);
         return 0;
     }
 
     // Interactive mode
+    if (args.count("stats")) stats.enable();
+
     Input::Manager inputManager;
-    for (char c : {'k','j','q','w','a','s','d','\n'})
+    for (char c : {'k','j','q','w','a','s','d','+','=','-','\n'})
         inputManager.addEvent(c, handleInput);
-
-    Color::RGB finalColor;
-    std::string display;
+    for (Input::Key key : {Input::Key::Up, Input::Key::Down, Input::Key::Left, Input::Key::Right, Input::Key::PageUp, Input::Key::PageDown})
+        inputManager.addKeyEvent(key, handleKey);
+    inputManager.setMouseHandler(handleMouse);
+    inputManager.setCursorHandler(handleCursor);
+    inputManager.setModeHandler(handleMode);
+
+    Input::Terminal terminal;
+    terminal.enableMouse();
+    state.mouse = terminal.isActive();
+    terminal.queryMode(SyncOutputMode);
+    fitToWindow(terminal);
+    size_t displayLines = 0;
+
+    typedef std::chrono::steady_clock Clock;
+    const auto frameInterval = std::chrono::microseconds(1000000 / state.fps);
+    auto nextFrame = Clock::now();
+    bool dirty = true;
 
     while (state.running) {
-        display = drawUI();
-        finalColor = Render::GetShadeColor(state.xSize, state.ySize, state.hue.h, state.selectedX, state.selectedY);
-        inputManager.update();
+        if (terminal.takeResize()) {
+            fitToWindow(terminal);
+            state.fullRedraw = true;
+            dirty = true;
+        }
+
+        // Draw at most one frame per interval, however many events arrived since the last one
+        auto now = Clock::now();
+        if (dirty && now >= nextFrame) {
+            displayLines = drawUI();
+            if (state.cursorQueried) {
+                inputManager.expectCursorReport();
+                state.cursorQueried = false;
+            }
+            dirty = false;
+            nextFrame = now + frameInterval;
+        }
+
+        // Sleep until input arrives, or only until the next frame may be drawn if one is due
+        int timeout = -1;
+        if (dirty) {
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(nextFrame - Clock::now());
+            timeout = static_cast<int>(std::max<std::chrono::milliseconds::rep>(0, wait.count()));
+        }
+
+        int received = inputManager.update(timeout);
+        if (received < 0) state.running = false;
+        else if (received > 0) dirty = true;
     }
+    terminal.restore();
+
+    // Keys that arrived together with the quit key still have to show up in the picker left on screen
+    if (!state.wipeScreen) displayLines = drawUI();
+
+    const Cache::Viewport& view = state.viewport;
+    Color::RGB finalColor = Render::GetShadeColor(static_cast<size_t>(state.xSize) << view.zoom,
+        static_cast<size_t>(state.ySize) << view.zoom, state.hue.h, view.x + state.selectedX, view.y + state.selectedY,
+        state.shadeModel);
 
+    std::string& wipe = state.output;
+    wipe.clear();
     if (state.wipeScreen) {
-        size_t lines = Utility::CountLines(display) + 1;
+        size_t lines = displayLines + 1;
 
         // Overwrite all lines
         for (size_t l = 0; l < lines; l++) {
-            std::cerr << "\r\033[2K";
-            if (l < lines - 1) std::cerr << "\n";
+            wipe += "\r\033[2K";
+            if (l < lines - 1) wipe += "\n";
         }
 
         // Move cursor back up to the top of cleared area
-        std::cerr << "\033[" << lines << "A" << "\n";
+        wipe += "\033[" + std::to_string(lines) + "A\n";
     } else {
-        size_t lines = Utility::CountLines(display);
-        Utility::CursorDown(std::cerr, lines);
+        wipe += "\033[" + std::to_string(displayLines) + "B";
     }
-
-    // Final output based on format
-    switch (state.format) {
-        case Format::RGB:
-            std::cout << (int)finalColor.r << "," << (int)finalColor.g << "," << (int)finalColor.b << "\n";
-            break;
-        case Format::HEX: {
-            Color::HEX hexColor;
-            Color::RGBtoHEX(hexColor, finalColor);
-            std::cout << hexColor << "\n";
-            break;
-        }
-        case Format::HSL: {
-            Color::HSL hsl;
-            Color::RGBtoHSL(hsl, finalColor);
-            std::cout << hsl.h * 100.0f << "," << hsl.s * 100.0f << "," << hsl.l * 100.0f << "\n";
-            break;
-        }
-        case Format::CMYK: {
-            Color::CMYK cmyk;
-            Color::RGBtoCMYK(cmyk, finalColor);
-            std::cout << cmyk.c * 100.0f << "," << cmyk.m * 100.0f << "," << cmyk.y * 100.0f << "," << cmyk.k * 100.0f << "\n";
-            break;
-        }
+    Utility::WriteAll(STDERR_FILENO, wipe.data(), wipe.size());
+
+    // Final output in the format or template that was asked for
+    std::string& result = state.output;
+    result.resize(outputTemplate.maxSize + 1);
+    size_t length = Template::Format(result.data(), outputTemplate, finalColor);
+    result[length++] = '\n';
+    Utility::WriteAll(STDOUT_FILENO, result.data(), length);
+
+    if (stats.isEnabled() && !stats.writeReport(args["stats"])) {
+        std::cerr << "Could not write stats to '" << args["stats"] << "'!\n";
+        return 1;
     }
 }